@@ -18,6 +18,7 @@
  */
 
 #include <stdexcept>
+#include <algorithm>
 #include <cassert>
 #include "PrefixSum.hpp"
 
@@ -32,20 +33,21 @@ PrefixSum::~PrefixSum(){
 void PrefixSum::Clear(){
   nodes_.clear();
   leaves_.clear();
+  free_nodes_.clear();
   val_sum_ = 0;
   root_ind_ = 0;
 }
 
 void PrefixSum::Insert(uint64_t ind, int64_t val){
-  if (ind > leaves_.size()){
+  if (ind > Num()){
     throw std::out_of_range("PrefixSum::InsertInternal out of range");
   }
   if (leaves_.size() == 0){
-    // ind == 0
-    leaves_.push_back(PrefixSumLeaf(-1, val));
+    leaves_.push_back(PrefixSumLeaf(-1));
     root_ind_ = -1; // = leaves_[0]
-  } else {
-    root_ind_ = InsertInternal(root_ind_, ind, val);
+  }
+  root_ind_ = InsertInternal(root_ind_, ind, &val, 1, val);
+  if (root_ind_ >= 0){
     nodes_[root_ind_].color = kBLACK;
   }
   val_sum_ += val;
@@ -56,30 +58,8 @@ void PrefixSum::Add(uint64_t ind, int64_t val){
     throw std::out_of_range("PrefixSum::Add out of range");  
   }
   val_sum_ += val;
-  if (Num() == 1){
-    leaves_[0].val += val;
-    return;
-  }
-  int64_t node_ind = root_ind_;
-  for (;;){
-    PrefixSumNode& node = nodes_[node_ind];
-    node.sum += val;
-    uint64_t left_weight = GetLeftWeight(node_ind);
-    if (ind < left_weight){
-      if (node.left_ind < 0){
-        leaves_[ToLeafInd(node.left_ind)].val += val;
-        return;
-      }
-      node_ind = node.left_ind;
-    } else {
-      ind -= left_weight;
-      if (node.right_ind < 0){
-        leaves_[ToLeafInd(node.right_ind)].val += val;
-        return;
-      }
-      node_ind = node.right_ind;
-    }
-  }
+  int64_t leaf_ind = UpdatePath(ind, 0, val);
+  leaves_[leaf_ind].Add(ind, val);
 }
 
 void PrefixSum::Set(uint64_t ind, int64_t val){
@@ -94,26 +74,8 @@ int64_t PrefixSum::Get(uint64_t ind) const{
   if (ind >= Num()){
     throw std::out_of_range("PrefixSum::Add out of range");  
   }
-  if (Num() == 1){
-    return leaves_[0].val;
-  }
-  int64_t node_ind = root_ind_;
-  for (;;){
-    const PrefixSumNode& node = nodes_[node_ind];
-    uint64_t left_weight = GetLeftWeight(node_ind);
-    if (ind < left_weight){
-      if (node.left_ind < 0){
-        return leaves_[ToLeafInd(node.left_ind)].val;
-      }
-      node_ind = node.left_ind;
-    } else {
-      if (node.right_ind < 0){
-        return leaves_[ToLeafInd(node.right_ind)].val;
-      }
-      ind -= left_weight;
-      node_ind = node.right_ind;
-    }
-  }
+  int64_t leaf_ind = FindLeaf(ind);
+  return leaves_[leaf_ind].Get(ind);
 }
 
 int64_t PrefixSum::GetPrefixSum(uint64_t ind) const{
@@ -123,9 +85,6 @@ int64_t PrefixSum::GetPrefixSum(uint64_t ind) const{
   if (ind == Num()){
     return val_sum_;
   }
-  if (Num() == 1){
-    return 0; // ind == 0
-  }
   int64_t node_ind = root_ind_;
   int64_t sum = 0;
   while (node_ind >= 0){
@@ -139,19 +98,15 @@ int64_t PrefixSum::GetPrefixSum(uint64_t ind) const{
       node_ind = node.right_ind;
     }
   }
-  return sum;
+  return sum + leaves_[ToLeafInd(node_ind)].GetPrefixSum(ind);
 }
 
 uint64_t PrefixSum::FindInPositiveValues(int64_t val) const{
-  if (val >= val_sum_){
+  if (val >= val_sum_ || leaves_.empty()){
     return Num();
   }
-  if (Num() == 1){
-    if (val < val_sum_) return 0;
-    else return 1;
-  }
   int64_t node_ind = root_ind_;
-  int64_t ind = 0;
+  uint64_t ind = 0;
   while (node_ind >= 0){
     const PrefixSumNode& node = nodes_[node_ind];
     int64_t left_val = GetLeftVal(node_ind);
@@ -163,40 +118,194 @@ uint64_t PrefixSum::FindInPositiveValues(int64_t val) const{
       node_ind = node.right_ind;
     }
   }
-  return ind;
+  return ind + leaves_[ToLeafInd(node_ind)].Find(val);
+}
+
+void PrefixSum::GetPrefixSumBatch(const uint64_t* inds, size_t n,
+                                  int64_t* out) const{
+  for (size_t i = 0; i < n; ++i){
+    if (inds[i] > Num()){
+      throw std::out_of_range("PrefixSum::GetPrefixSumBatch out of range");
+    }
+  }
+  for (size_t i = 0; i < n; i += kBatchGroup){
+    GetPrefixSumGroup(inds + i, (n - i < kBatchGroup) ? n - i : kBatchGroup, out + i);
+  }
+}
+
+void PrefixSum::FindBatch(const int64_t* vals, size_t n, uint64_t* out) const{
+  for (size_t i = 0; i < n; i += kBatchGroup){
+    FindGroup(vals + i, (n - i < kBatchGroup) ? n - i : kBatchGroup, out + i);
+  }
+}
+
+// GetPrefixSumBatch for n <= kBatchGroup queries. Each round first
+// touches the left child of every lane, whose weight decides the
+// direction, and then moves every lane one level down.
+void PrefixSum::GetPrefixSumGroup(const uint64_t* inds, size_t n,
+                                  int64_t* out) const{
+  if (leaves_.empty()){
+    std::fill(out, out + n, 0);
+    return;
+  }
+  int64_t node[kBatchGroup];
+  uint64_t ind[kBatchGroup];
+  int64_t sum[kBatchGroup];
+  for (size_t j = 0; j < n; ++j){
+    node[j] = root_ind_;
+    ind[j] = inds[j];
+    sum[j] = 0;
+  }
+  for (size_t active = n; active > 0; ){
+    for (size_t j = 0; j < n; ++j){
+      if (node[j] >= 0) Prefetch(nodes_[node[j]].left_ind);
+    }
+    active = 0;
+    for (size_t j = 0; j < n; ++j){
+      int64_t h = node[j];
+      if (h < 0) continue;
+      uint64_t left_weight = GetLeftWeight(h);
+      bool to_right = ind[j] >= left_weight;
+      sum[j] += to_right ? GetLeftVal(h) : 0;
+      ind[j] -= to_right ? left_weight : 0;
+      h = to_right ? nodes_[h].right_ind : nodes_[h].left_ind;
+      Prefetch(h);
+      node[j] = h;
+      active += (h >= 0);
+    }
+  }
+  for (size_t j = 0; j < n; ++j){
+    __builtin_prefetch(leaves_[ToLeafInd(node[j])].bytes.data());
+  }
+  for (size_t j = 0; j < n; ++j){
+    out[j] = sum[j] + leaves_[ToLeafInd(node[j])].GetPrefixSum(ind[j]);
+  }
+}
+
+// FindBatch for n <= kBatchGroup queries, as GetPrefixSumGroup.
+// A lane whose answer is Num() skips the descent, marked by kNULL.
+void PrefixSum::FindGroup(const int64_t* vals, size_t n, uint64_t* out) const{
+  if (leaves_.empty()){
+    std::fill(out, out + n, 0);
+    return;
+  }
+  int64_t node[kBatchGroup];
+  int64_t val[kBatchGroup];
+  uint64_t ind[kBatchGroup];
+  for (size_t j = 0; j < n; ++j){
+    node[j] = (vals[j] >= val_sum_) ? kNULL : root_ind_;
+    val[j] = vals[j];
+    ind[j] = 0;
+  }
+  for (size_t active = n; active > 0; ){
+    for (size_t j = 0; j < n; ++j){
+      if (node[j] >= 0) Prefetch(nodes_[node[j]].left_ind);
+    }
+    active = 0;
+    for (size_t j = 0; j < n; ++j){
+      int64_t h = node[j];
+      if (h < 0) continue;
+      int64_t left_val = GetLeftVal(h);
+      bool to_right = val[j] >= left_val;
+      val[j] -= to_right ? left_val : 0;
+      ind[j] += to_right ? GetLeftWeight(h) : 0;
+      h = to_right ? nodes_[h].right_ind : nodes_[h].left_ind;
+      Prefetch(h);
+      node[j] = h;
+      active += (h >= 0);
+    }
+  }
+  for (size_t j = 0; j < n; ++j){
+    if (node[j] != kNULL){
+      __builtin_prefetch(leaves_[ToLeafInd(node[j])].bytes.data());
+    }
+  }
+  for (size_t j = 0; j < n; ++j){
+    out[j] = (node[j] == kNULL) ? Num() :
+      ind[j] + leaves_[ToLeafInd(node[j])].Find(val[j]);
+  }
+}
+
+// Prefetch the node or the leaf header at ind.
+void PrefixSum::Prefetch(int64_t ind) const{
+  if (ind >= 0){
+    __builtin_prefetch(&nodes_[ind]);
+  } else {
+    __builtin_prefetch(&leaves_[ToLeafInd(ind)]);
+  }
+}
+
+// Return the leaf holding vs[ind], and set ind to the position in it.
+int64_t PrefixSum::FindLeaf(uint64_t& ind) const{
+  int64_t node_ind = root_ind_;
+  while (node_ind >= 0){
+    const PrefixSumNode& node = nodes_[node_ind];
+    uint64_t left_weight = GetLeftWeight(node_ind);
+    if (ind < left_weight){
+      node_ind = node.left_ind;
+    } else {
+      ind -= left_weight;
+      node_ind = node.right_ind;
+    }
+  }
+  return ToLeafInd(node_ind);
 }
 
-int64_t PrefixSum::InsertInternal(int64_t node_ind, uint64_t ind, int64_t val){
+// Same as FindLeaf, adding weight_diff and sum_diff to the nodes on
+// the path.
+int64_t PrefixSum::UpdatePath(uint64_t& ind, int64_t weight_diff,
+                              int64_t sum_diff){
+  int64_t node_ind = root_ind_;
+  while (node_ind >= 0){
+    PrefixSumNode& node = nodes_[node_ind];
+    node.weight += weight_diff;
+    node.sum += sum_diff;
+    uint64_t left_weight = GetLeftWeight(node_ind);
+    if (ind < left_weight){
+      node_ind = node.left_ind;
+    } else {
+      ind -= left_weight;
+      node_ind = node.right_ind;
+    }
+  }
+  return ToLeafInd(node_ind);
+}
+
+// Insert vals[0...num-1], whose sum is sum, before the ind-th value
+// below node_ind, and return the new subtree root. A leaf that
+// overflows is split in halves under a new red node.
+int64_t PrefixSum::InsertInternal(int64_t node_ind, uint64_t ind,
+                                  const int64_t* vals, uint64_t num,
+                                  int64_t sum){
   if (node_ind < 0){
-    assert(ind < 2);
-    int64_t pre_leave_ind = node_ind;
-    PrefixSumLeaf& pre_leaf = leaves_[ToLeafInd(pre_leave_ind)];
-    int64_t leaf_val = pre_leaf.val;
-    PrefixSumNode new_node(2, leaf_val + val);
-    int64_t new_node_ind = nodes_.size();
-    pre_leaf.parent = new_node_ind;
-    leaves_.push_back(PrefixSumLeaf(new_node_ind, val));
-    int64_t new_leave_ind = -(static_cast<int64_t>(leaves_.size()));
-    new_node.left_ind = (ind == 0) ? new_leave_ind : pre_leave_ind;
-    new_node.right_ind = (ind == 0) ? pre_leave_ind : new_leave_ind;
-    nodes_.push_back(new_node);
+    int64_t leaf_ind = ToLeafInd(node_ind);
+    leaves_[leaf_ind].Insert(ind, vals, num, sum);
+    if (leaves_[leaf_ind].Num() <= kLeafMax){
+      return node_ind;
+    }
+    PrefixSumLeaf& leaf = leaves_[leaf_ind];
+    PrefixSumNode new_node(leaf.Num(), leaf.sum);
+    new_node.left_ind = node_ind;
+    new_node.right_ind = -(static_cast<int64_t>(leaves_.size()) + 1);
+    int64_t new_node_ind = NewNode(new_node);
+    leaf.parent = new_node_ind;
+    leaves_.push_back(PrefixSumLeaf(new_node_ind));
+    leaves_[leaf_ind].SplitTo(leaves_[leaf_ind].Num() / 2, leaves_.back());
     return new_node_ind;
   }
   
   PrefixSumNode& node = nodes_[node_ind];
-  node.weight += 1;
-  node.sum += val;
-  if (IsRED(node.left_ind) && IsRED(node.right_ind)){
-    FlipColor(node_ind);
-  }
+  node.weight += num;
+  node.sum += sum;
 
   uint64_t left_weight = GetLeftWeight(node_ind);
   const PrefixSumNode& cur_node = nodes_[node_ind];
   if (ind < left_weight){
-    int ret = InsertInternal(cur_node.left_ind, ind, val);
+    int64_t ret = InsertInternal(cur_node.left_ind, ind, vals, num, sum);
     nodes_[node_ind].left_ind = ret;
   } else {
-    int64_t ret = InsertInternal(cur_node.right_ind, ind - left_weight, val);
+    int64_t ret = InsertInternal(cur_node.right_ind, ind - left_weight,
+                                 vals, num, sum);
     nodes_[node_ind].right_ind = ret;
   }
  
@@ -210,7 +319,12 @@ int64_t PrefixSum::InsertInternal(int64_t node_ind, uint64_t ind, int64_t val){
       node_ind = RotateRight(node_ind);
     }
   }
-  
+  // split 4-nodes on the way up, so that the tree stays a 2-3 tree
+  // as Delete() expects
+  if (IsRED(nodes_[node_ind].left_ind) && IsRED(nodes_[node_ind].right_ind)){
+    FlipColor(node_ind);
+  }
+
   return node_ind;
 }
 
@@ -283,48 +397,92 @@ int64_t PrefixSum::RotateRight(int64_t h_ind){
   return x_ind;
 }
 
-/*
-void PrefixSum::Delete(int64_t ind){
-  if (ind >= num_){
-    throw std::out_of_range("PrefixSum::InsertInternal out of range");
+void PrefixSum::Delete(uint64_t ind){
+  if (ind >= Num()){
+    throw std::out_of_range("PrefixSum::Delete out of range");
+  }
+  uint64_t offset = ind;
+  int64_t leaf_ind = FindLeaf(offset);
+  const PrefixSumLeaf& leaf = leaves_[leaf_ind];
+  int64_t val = leaf.Get(offset);
+  if (root_ind_ < 0 && leaf.Num() == 1){
+    Clear();
+    return;
+  }
+  val_sum_ -= val;
+  if (root_ind_ < 0 || leaf.Num() > kLeafMin){
+    UpdatePath(ind, -1, -val);
+    leaves_[leaf_ind].Erase(offset);
+    return;
   }
-  root_ind_ = DeleteInternal(root_ind_, ind);
+  // The leaf would become too small; remove it, and move the rest of
+  // its values to the neighbor.
+  std::vector<int64_t> rest;
+  leaf.Decode(rest);
+  rest.erase(rest.begin() + offset);
+  int64_t rest_sum = leaf.sum - val;
+  uint64_t pos = ind - offset;
+  RemoveBlock(pos);
+  if (!rest.empty()){
+    root_ind_ = InsertInternal(root_ind_, pos, &rest[0], rest.size(), rest_sum);
+    if (root_ind_ >= 0){
+      nodes_[root_ind_].color = kBLACK;
+    }
+  }
+}
+
+// Remove the leaf whose first value is vs[pos] from the tree.
+void PrefixSum::RemoveBlock(uint64_t pos){
+  PrefixSumNode& root = nodes_[root_ind_];
+  if (!IsRED(root.left_ind) && !IsRED(root.right_ind)){
+    root.color = kRED;
+  }
+  int64_t leaf_ind = 0;
+  root_ind_ = DeleteInternal(root_ind_, pos, leaf_ind);
   if (root_ind_ >= 0){
     nodes_[root_ind_].color = kBLACK;
+  } else {
+    leaves_[ToLeafInd(root_ind_)].parent = -1;
   }
-  //sum_ += val;
-  --num_;
+  RemoveLeaf(leaf_ind);
 }
-*/
 
-/*
-int64_t PrefixSum::DeleteInternal(int64_t node_ind, int64_t ind){
-  if (node_ind < 0){
-    int64_t delete_leaf_ind = ToLeafInd(node_ind);
-    if (delete_leaf_ind != leaves_.size()-1){
-      std::swap(leaves_[delete_leaf_ind], leaves_[leaves_.size()-1]);
-      
+// Delete the leaf holding the ind-th value below node_ind, store its
+// index in leaf_ind,
+// and return the new subtree root. The leaf and its parent node go,
+// and the sibling of the leaf takes the place of the parent.
+// As in the top-down LLRB deletion, node_ind or its child toward ind is
+// red on entry, so that the parent of the leaf is red.
+int64_t PrefixSum::DeleteInternal(int64_t node_ind, uint64_t ind,
+                                  int64_t& leaf_ind){
+  if (ind < GetLeftWeight(node_ind)){
+    int64_t left_ind = nodes_[node_ind].left_ind;
+    if (left_ind < 0){
+      leaf_ind = ToLeafInd(left_ind);
+      free_nodes_.push_back(node_ind);
+      return nodes_[node_ind].right_ind;
     }
-    return -777;
-  }
-  int64_t left_weight = GetLeftWeight(node_ind);
-  int64_t left_ind = nodes_[node_ind].left_ind;
-  if (ind < left_weight){
-    if (!IsRED(left_ind) && left_ind >= 0 && !IsRED(nodes_[left_ind].left_ind)){
+    if (!IsRED(left_ind) && !IsRED(nodes_[left_ind].left_ind)){
       node_ind = MoveREDLeft(node_ind);
     }
-    int ret = DeleteInternal(nodes_[node_ind].left_ind, ind);
-    nodes_[node_ind].left_ind = ret;
+    int64_t ret = DeleteInternal(nodes_[node_ind].left_ind, ind, leaf_ind);
+    SetChild(node_ind, ret, true);
   } else {
-    if (IsRED(left_ind)){
+    if (IsRED(nodes_[node_ind].left_ind)){
       node_ind = RotateRight(node_ind);
     }
     int64_t right_ind = nodes_[node_ind].right_ind;
-    if (!IsRED(right_ind) && right_ind >= 0 && !IsRED(nodes_[right_ind].left_ind)){
+    if (right_ind < 0){
+      leaf_ind = ToLeafInd(right_ind);
+      free_nodes_.push_back(node_ind);
+      return nodes_[node_ind].left_ind;
+    }
+    if (!IsRED(right_ind) && !IsRED(nodes_[right_ind].left_ind)){
       node_ind = MoveREDRight(node_ind);
     }
-    int ret = DeleteInternal(nodes_[node_ind].right_ind, ind - left_weight); 
-    nodes_[node_ind].right_ind = ret;
+    int64_t ret = DeleteInternal(nodes_[node_ind].right_ind,
+                                 ind - GetLeftWeight(node_ind), leaf_ind);
+    SetChild(node_ind, ret, false);
   }
   return FixUp(node_ind);
 }
@@ -351,7 +509,6 @@ int64_t PrefixSum::MoveREDRight(int64_t node_ind){
 }
 
 int64_t PrefixSum::FixUp(int64_t node_ind){
-  if (node_ind < 0) return node_ind;
   if (IsRED(nodes_[node_ind].right_ind)){
     node_ind = RotateLeft(node_ind);
   }
@@ -364,6 +521,100 @@ int64_t PrefixSum::FixUp(int64_t node_ind){
   }
   return node_ind;
 }
-*/
+
+// Store node in a free slot if any, and return its index.
+int64_t PrefixSum::NewNode(const PrefixSumNode& node){
+  if (free_nodes_.empty()){
+    nodes_.push_back(node);
+    return nodes_.size() - 1;
+  }
+  int64_t node_ind = free_nodes_.back();
+  free_nodes_.pop_back();
+  nodes_[node_ind] = node;
+  return node_ind;
+}
+
+// Link child_ind below node_ind and recompute the weight and the sum.
+void PrefixSum::SetChild(int64_t node_ind, int64_t child_ind, bool left){
+  PrefixSumNode& node = nodes_[node_ind];
+  if (left){
+    node.left_ind = child_ind;
+  } else {
+    node.right_ind = child_ind;
+  }
+  if (child_ind < 0){
+    leaves_[ToLeafInd(child_ind)].parent = node_ind;
+  }
+  node.weight = GetLeftWeight(node_ind) + GetRightWeight(node_ind);
+  node.sum = GetLeftVal(node_ind) + GetRightVal(node_ind);
+}
+
+// Free the slot of an unlinked leaf by moving the last leaf into it.
+void PrefixSum::RemoveLeaf(int64_t leaf_ind){
+  int64_t last_ind = leaves_.size() - 1;
+  if (leaf_ind != last_ind){
+    std::swap(leaves_[leaf_ind], leaves_[last_ind]);
+    int64_t parent_ind = leaves_[leaf_ind].parent;
+    int64_t from = -last_ind - 1;
+    int64_t to = -leaf_ind - 1;
+    if (parent_ind < 0){
+      root_ind_ = to;
+    } else if (nodes_[parent_ind].left_ind == from){
+      nodes_[parent_ind].left_ind = to;
+    } else {
+      nodes_[parent_ind].right_ind = to;
+    }
+  }
+  leaves_.pop_back();
+}
+
+size_t PrefixSum::ByteSize() const{
+  size_t size = nodes_.capacity() * sizeof(PrefixSumNode)
+    + leaves_.capacity() * sizeof(PrefixSumLeaf)
+    + free_nodes_.capacity() * sizeof(int64_t);
+  for (size_t i = 0; i < leaves_.size(); ++i){
+    size += leaves_[i].bytes.capacity();
+  }
+  return size;
+}
+
+bool PrefixSum::IsValid() const{
+  if (leaves_.empty()) return nodes_.size() == free_nodes_.size();
+  if (IsRED(root_ind_)) return false;
+  uint64_t weight = 0;
+  int64_t sum = 0;
+  if (IsValidInternal(root_ind_, -1, weight, sum) < 0) return false;
+  return weight == Num() && sum == val_sum_ &&
+    nodes_.size() == leaves_.size() - 1 + free_nodes_.size();
+}
+
+// Return the black height, or -1 if the subtree is invalid.
+int PrefixSum::IsValidInternal(int64_t ind, int64_t parent_ind,
+                               uint64_t& weight, int64_t& sum) const{
+  if (ind < 0){
+    const PrefixSumLeaf& leaf = leaves_[ToLeafInd(ind)];
+    if (leaf.parent != parent_ind) return -1;
+    if (leaf.Num() == 0 || leaf.Num() > kLeafMax) return -1;
+    if (parent_ind >= 0 && leaf.Num() < kLeafMin) return -1;
+    weight = leaf.Num();
+    sum = leaf.GetPrefixSum(leaf.Num());
+    if (leaf.sum != sum) return -1;
+    return 0;
+  }
+  const PrefixSumNode& node = nodes_[ind];
+  if (IsRED(node.right_ind)) return -1;
+  if (IsRED(ind) && IsRED(node.left_ind)) return -1;
+  uint64_t left_weight = 0;
+  uint64_t right_weight = 0;
+  int64_t left_sum = 0;
+  int64_t right_sum = 0;
+  int left_height = IsValidInternal(node.left_ind, ind, left_weight, left_sum);
+  int right_height = IsValidInternal(node.right_ind, ind, right_weight, right_sum);
+  if (left_height < 0 || left_height != right_height) return -1;
+  weight = left_weight + right_weight;
+  sum = left_sum + right_sum;
+  if (node.weight != weight || node.sum != sum) return -1;
+  return left_height + (IsRED(ind) ? 0 : 1);
+}
 
 } // namespace prefixsum
@@ -35,6 +35,11 @@ namespace prefixsum{
  *   find(i)         : return i s.t. prefixum(k) <= i < prefixsum(k+1)
  *   insert(i, x)    : vs <- vs[0...i-1] x vs[i ... num_-1]
  *   set(i, x)       : vs[i] <- x
+ * The values are stored in blocks of up to kLeafMax consecutive values,
+ * one per leaf of a left-leaning red-black tree whose nodes hold the
+ * number and the sum of the values below them. A query descends to a
+ * leaf and finishes with a scan of its block. A block stores its values
+ * in the narrowest of 1, 2, 4 or 8 bytes that holds them all.
  */
 class PrefixSum{
 public:
@@ -58,7 +63,10 @@ public:
    */
   void Insert(uint64_t ind, int64_t val);
 
-  //void Delete(int64_t ind);
+  /**
+   * Remove vs[ind]: vs <- vs[0...ind-1] x vs[ind+1 ... num_-1]
+   */
+  void Delete(uint64_t ind);
 
   /**
    * Increment current value vs[ind] <- max(vs[ind] + val, 0)
@@ -86,9 +94,32 @@ public:
   uint64_t FindInPositiveValues(int64_t val) const;
 
   /**
-   * Return the number of leaves
+   * Set out[i] <- GetPrefixSum(inds[i]) for i in [0, n).
+   * The queries descend kBatchGroup at a time, one level per round,
+   * prefetching the nodes each needs next, so that a group waits for
+   * its cache misses together rather than one after another.
+   */
+  void GetPrefixSumBatch(const uint64_t* inds, size_t n, int64_t* out) const;
+
+  /**
+   * Set out[i] <- FindInPositiveValues(vals[i]) for i in [0, n),
+   * running the queries as GetPrefixSumBatch
+   */
+  void FindBatch(const int64_t* vals, size_t n, uint64_t* out) const;
+
+  /**
+   * Return the number of values
    */
   size_t Num() const {
+    if (leaves_.empty()) return 0;
+    if (root_ind_ < 0) return leaves_[ToLeafInd(root_ind_)].Num();
+    return nodes_[root_ind_].weight;
+  }
+
+  /**
+   * Return the number of leaves (blocks of values)
+   */
+  size_t LeafNum() const {
     return leaves_.size();
   }
 
@@ -115,7 +146,30 @@ public:
     CheckParentInternal(root_ind_, -1);
   }
 
+  /**
+   * Return true iff the tree is a valid left-leaning red-black tree
+   * whose weights, sums and leaf parents are consistent
+   */
+  bool IsValid() const;
+
+  /**
+   * Return the number of bytes allocated for the nodes and the leaves
+   */
+  size_t ByteSize() const;
+
+  /**
+   * Return the number of node slots, including the free ones
+   */
+  size_t NodeSlotNum() const {
+    return nodes_.size();
+  }
+
 private:
+  // The batch queries advance this many descents in lockstep; enough
+  // misses in flight to cover the memory latency, few enough to keep
+  // the state of every lane in registers and L1.
+  static const size_t kBatchGroup = 16;
+
   void CheckParentInternal(int64_t node_ind, int64_t parent_ind) const{
     if (node_ind < 0){
       if (leaves_[ToLeafInd(node_ind)].parent != parent_ind){
@@ -133,7 +187,7 @@ private:
       std::cout << " ";
     }
     if (ind < 0) {
-      std::cout << leaves_[ToLeafInd(ind)].parent << "#" << ToLeafInd(ind) << ":" << leaves_[ToLeafInd(ind)].val << std::endl;
+      std::cout << leaves_[ToLeafInd(ind)].parent << "#" << ToLeafInd(ind) << ":" << leaves_[ToLeafInd(ind)].Num() << ":" << leaves_[ToLeafInd(ind)].sum << std::endl;
     } else {
       std::cout << ind << ":" << nodes_[ind].weight << ":" << nodes_[ind].sum << std::endl;
       PrintInternal(nodes_[ind].left_ind, depth+1);
@@ -145,11 +199,23 @@ private:
     return - ind - 1;
   }
 
-  int64_t InsertInternal(int64_t node_ind, uint64_t ind, int64_t val);
-  //int64_t DeleteInternal(int64_t node_ind, int64_t ind);
-  //int64_t MoveREDLeft(int64_t node_ind);
-  //int64_t MoveREDRight(int64_t node_ind);
-  //int64_t FixUp(int64_t node_ind);
+  int64_t FindLeaf(uint64_t& ind) const;
+  int64_t UpdatePath(uint64_t& ind, int64_t weight_diff, int64_t sum_diff);
+  int64_t InsertInternal(int64_t node_ind, uint64_t ind,
+                         const int64_t* vals, uint64_t num, int64_t sum);
+  void RemoveBlock(uint64_t pos);
+  void GetPrefixSumGroup(const uint64_t* inds, size_t n, int64_t* out) const;
+  void FindGroup(const int64_t* vals, size_t n, uint64_t* out) const;
+  void Prefetch(int64_t ind) const;
+  int64_t DeleteInternal(int64_t node_ind, uint64_t ind, int64_t& leaf_ind);
+  int64_t MoveREDLeft(int64_t node_ind);
+  int64_t MoveREDRight(int64_t node_ind);
+  int64_t FixUp(int64_t node_ind);
+  int64_t NewNode(const PrefixSumNode& node);
+  void SetChild(int64_t node_ind, int64_t child_ind, bool left);
+  void RemoveLeaf(int64_t leaf_ind);
+  int IsValidInternal(int64_t ind, int64_t parent_ind,
+                      uint64_t& weight, int64_t& sum) const;
 
   // Left-Leaning Red-Black Tree
   bool IsRED(int64_t node_ind) const;
@@ -160,28 +226,28 @@ private:
   uint64_t GetLeftWeight(int64_t node_ind) const{
     if (node_ind < 0) return 0;
     int64_t left_ind = nodes_[node_ind].left_ind;
-    if (left_ind < 0) return 1;
+    if (left_ind < 0) return leaves_[-left_ind-1].Num();
     return nodes_[left_ind].weight;
   }
 
   int64_t GetLeftVal(int64_t node_ind) const{
     if (node_ind < 0) return 0;
     int64_t left_ind = nodes_[node_ind].left_ind;
-    if (left_ind < 0) return leaves_[-left_ind-1].val;
+    if (left_ind < 0) return leaves_[-left_ind-1].sum;
     return nodes_[left_ind].sum;
   }
 
   uint64_t GetRightWeight(int64_t node_ind) const{
     if (node_ind < 0) return 0;
     int64_t right_ind = nodes_[node_ind].right_ind;
-    if (right_ind < 0) return 1;
+    if (right_ind < 0) return leaves_[-right_ind-1].Num();
     return nodes_[right_ind].weight;
   }
 
   int64_t GetRightVal(int64_t node_ind) const{
     if (node_ind < 0) return 0;
     int64_t right_ind = nodes_[node_ind].right_ind;
-    if (right_ind < 0) return leaves_[-right_ind-1].val;
+    if (right_ind < 0) return leaves_[-right_ind-1].sum;
     return nodes_[right_ind].sum;
   }
 
@@ -204,6 +270,7 @@ private:
 
   std::vector<PrefixSumNode> nodes_;
   std::vector<PrefixSumLeaf> leaves_;
+  std::vector<int64_t> free_nodes_; // slots of deleted nodes
   int64_t val_sum_;
   int64_t root_ind_;
 };
@@ -0,0 +1,239 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <string.h>
+#include "PrefixSumKernel.hpp"
+
+// The SIMD kernels move 64-bit lanes to and from general registers,
+// which needs x86-64; 32-bit x86 uses the scalar kernel only.
+#if defined(__x86_64__)
+#define PREFIXSUM_X86
+#include <immintrin.h>
+#endif
+
+namespace prefixsum {
+
+namespace {
+
+// Values are stored as T, and widened to int64_t when read.
+template <class T>
+int64_t SumScalar(const void* data, uint64_t num){
+  const T* vals = static_cast<const T*>(data);
+  int64_t sum = 0;
+  for (uint64_t i = 0; i < num; ++i){
+    sum += vals[i];
+  }
+  return sum;
+}
+
+template <class T>
+uint64_t FindScalar(const void* data, uint64_t num, int64_t val){
+  const T* vals = static_cast<const T*>(data);
+  for (uint64_t i = 0; i < num; ++i){
+    if (val < vals[i]) return i;
+    val -= vals[i];
+  }
+  return num;
+}
+
+#ifdef PREFIXSUM_X86
+
+// Load two consecutive values sign-extended to 64 bits.
+__attribute__((target("sse4.2")))
+inline __m128i Load2(const int8_t* p){
+  int16_t x;
+  memcpy(&x, p, sizeof(x));
+  return _mm_cvtepi8_epi64(_mm_cvtsi32_si128(x));
+}
+
+__attribute__((target("sse4.2")))
+inline __m128i Load2(const int16_t* p){
+  int32_t x;
+  memcpy(&x, p, sizeof(x));
+  return _mm_cvtepi16_epi64(_mm_cvtsi32_si128(x));
+}
+
+__attribute__((target("sse4.2")))
+inline __m128i Load2(const int32_t* p){
+  return _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)p));
+}
+
+__attribute__((target("sse4.2")))
+inline __m128i Load2(const int64_t* p){
+  return _mm_loadu_si128((const __m128i*)p);
+}
+
+template <class T>
+__attribute__((target("sse4.2")))
+int64_t SumSSE42(const void* data, uint64_t num){
+  const T* vals = static_cast<const T*>(data);
+  __m128i acc0 = _mm_setzero_si128();
+  __m128i acc1 = _mm_setzero_si128();
+  uint64_t i = 0;
+  for (; i + 4 <= num; i += 4){
+    acc0 = _mm_add_epi64(acc0, Load2(vals + i));
+    acc1 = _mm_add_epi64(acc1, Load2(vals + i + 2));
+  }
+  acc0 = _mm_add_epi64(acc0, acc1);
+  int64_t sum = _mm_cvtsi128_si64(acc0) + _mm_extract_epi64(acc0, 1);
+  for (; i < num; ++i){
+    sum += vals[i];
+  }
+  return sum;
+}
+
+// Compute the running sums of two values at a time, and compare them
+// with val at once.
+template <class T>
+__attribute__((target("sse4.2")))
+uint64_t FindSSE42(const void* data, uint64_t num, int64_t val){
+  const T* vals = static_cast<const T*>(data);
+  const __m128i target = _mm_set1_epi64x(val);
+  __m128i base = _mm_setzero_si128();
+  uint64_t i = 0;
+  for (; i + 2 <= num; i += 2){
+    __m128i v = Load2(vals + i);
+    v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi64(v, base);
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, target)));
+    if (mask != 0) return i + __builtin_ctz(mask);
+    base = _mm_unpackhi_epi64(v, v);
+  }
+  int64_t rest = val - _mm_cvtsi128_si64(base);
+  return i + FindScalar<T>(vals + i, num - i, rest);
+}
+
+// Load four consecutive values sign-extended to 64 bits.
+__attribute__((target("avx2")))
+inline __m256i Load4(const int8_t* p){
+  int32_t x;
+  memcpy(&x, p, sizeof(x));
+  return _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(x));
+}
+
+__attribute__((target("avx2")))
+inline __m256i Load4(const int16_t* p){
+  return _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i*)p));
+}
+
+__attribute__((target("avx2")))
+inline __m256i Load4(const int32_t* p){
+  return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)p));
+}
+
+__attribute__((target("avx2")))
+inline __m256i Load4(const int64_t* p){
+  return _mm256_loadu_si256((const __m256i*)p);
+}
+
+template <class T>
+__attribute__((target("avx2")))
+int64_t SumAVX2(const void* data, uint64_t num){
+  const T* vals = static_cast<const T*>(data);
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  uint64_t i = 0;
+  for (; i + 8 <= num; i += 8){
+    acc0 = _mm256_add_epi64(acc0, Load4(vals + i));
+    acc1 = _mm256_add_epi64(acc1, Load4(vals + i + 4));
+  }
+  acc0 = _mm256_add_epi64(acc0, acc1);
+  __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc0),
+                              _mm256_extracti128_si256(acc0, 1));
+  int64_t sum = _mm_cvtsi128_si64(acc) + _mm_extract_epi64(acc, 1);
+  for (; i < num; ++i){
+    sum += vals[i];
+  }
+  return sum;
+}
+
+// Four values at a time: the running sums within the vector take two
+// shifted adds, and the last one is broadcast as the next base.
+template <class T>
+__attribute__((target("avx2")))
+uint64_t FindAVX2(const void* data, uint64_t num, int64_t val){
+  const T* vals = static_cast<const T*>(data);
+  const __m256i target = _mm256_set1_epi64x(val);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i base = zero;
+  uint64_t i = 0;
+  for (; i + 4 <= num; i += 4){
+    __m256i v = Load4(vals + i);
+    // (v0, v1, v2, v3) + (0, v0, v1, v2)
+    v = _mm256_add_epi64(v, _mm256_blend_epi32(
+      _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03));
+    // + (0, 0, s0, s1)
+    v = _mm256_add_epi64(v, _mm256_blend_epi32(
+      _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0F));
+    v = _mm256_add_epi64(v, base);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, target)));
+    if (mask != 0) return i + __builtin_ctz(mask);
+    base = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  int64_t rest = val - _mm256_extract_epi64(base, 0);
+  return i + FindScalar<T>(vals + i, num - i, rest);
+}
+
+#endif // PREFIXSUM_X86
+
+#define PREFIXSUM_KERNEL(name, Sum, Find) \
+  {name, {Sum<int8_t>, Sum<int16_t>, Sum<int32_t>, Sum<int64_t>}, \
+   {Find<int8_t>, Find<int16_t>, Find<int32_t>, Find<int64_t>}}
+
+const PrefixSumKernel kScalar = PREFIXSUM_KERNEL("scalar", SumScalar, FindScalar);
+#ifdef PREFIXSUM_X86
+const PrefixSumKernel kSSE42 = PREFIXSUM_KERNEL("sse4.2", SumSSE42, FindSSE42);
+const PrefixSumKernel kAVX2 = PREFIXSUM_KERNEL("avx2", SumAVX2, FindAVX2);
+#endif
+
+#undef PREFIXSUM_KERNEL
+
+struct KernelList{
+  KernelList() : num(0){
+    kernels[num++] = &kScalar;
+#ifdef PREFIXSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) kernels[num++] = &kSSE42;
+    if (__builtin_cpu_supports("avx2")) kernels[num++] = &kAVX2;
+#endif
+  }
+
+  const PrefixSumKernel* kernels[3];
+  int num;
+};
+
+const KernelList& Kernels(){
+  static const KernelList list;
+  return list;
+}
+
+} // namespace
+
+const PrefixSumKernel& Kernel(){
+  static const PrefixSumKernel& kernel =
+    *Kernels().kernels[Kernels().num - 1];
+  return kernel;
+}
+
+const PrefixSumKernel* const* SupportedKernels(int& num){
+  num = Kernels().num;
+  return Kernels().kernels;
+}
+
+} // namespace prefixsum
@@ -0,0 +1,53 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef PREFIXSUM_PREFIXSUM_KERNEL_HPP_
+#define PREFIXSUM_PREFIXSUM_KERNEL_HPP_
+
+#include <stdint.h>
+
+namespace prefixsum {
+
+/**
+ * Scans over the values of a leaf, used at the end of every query.
+ *   sum[w](vals, num)       : return vals[0] + ... + vals[num-1]
+ *   find[w](vals, num, val) : return the first i s.t.
+ *                             val < vals[0] + ... + vals[i], or num if none
+ * where vals is an array of the signed integers of 2^w bytes
+ * (int8_t, int16_t, int32_t or int64_t).
+ * Kernel() returns the fastest implementation the CPU supports,
+ * chosen once at the first call.
+ */
+struct PrefixSumKernel{
+  const char* name;
+  int64_t (*sum[4])(const void* vals, uint64_t num);
+  uint64_t (*find[4])(const void* vals, uint64_t num, int64_t val);
+};
+
+const PrefixSumKernel& Kernel();
+
+/**
+ * Return the implementations this CPU supports, the scalar one first,
+ * and set num to their number. For tests and benchmarks.
+ */
+const PrefixSumKernel* const* SupportedKernels(int& num);
+
+} // namespace prefixsum
+
+#endif // PREFIXSUM_PREFIXSUM_KERNEL_HPP_
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "PrefixSumKernel.hpp"
+
+using namespace std;
+using namespace prefixsum;
+
+namespace {
+
+// Store vals as the integers of 2^width bytes, with trailing slack so
+// that an empty array has a valid address.
+vector<uint8_t> Encode(const vector<int64_t>& vals, int width){
+  vector<uint8_t> bytes((vals.size() + 1) << width);
+  for (size_t i = 0; i < vals.size(); ++i){
+    int8_t v8 = vals[i];
+    int16_t v16 = vals[i];
+    int32_t v32 = vals[i];
+    int64_t v64 = vals[i];
+    const void* src[] = {&v8, &v16, &v32, &v64};
+    memcpy(&bytes[i << width], src[width], 1 << width);
+  }
+  return bytes;
+}
+
+// Random values in the range of 2^width byte integers
+vector<int64_t> RandomVals(size_t num, int width, int64_t max){
+  vector<int64_t> vals(num);
+  int64_t limit = min(max, int64_t(1) << ((8 << width) - 2));
+  for (size_t i = 0; i < num; ++i){
+    vals[i] = rand() % limit - limit / 2;
+  }
+  return vals;
+}
+
+} // namespace
+
+TEST(PrefixSumKernel, supported){
+  int num = 0;
+  const PrefixSumKernel* const* kernels = SupportedKernels(num);
+  ASSERT_LE(1, num);
+  EXPECT_STREQ("scalar", kernels[0]->name);
+  EXPECT_EQ(kernels[num - 1], &Kernel());
+}
+
+TEST(PrefixSumKernel, sum){
+  int num = 0;
+  const PrefixSumKernel* const* kernels = SupportedKernels(num);
+  for (int width = 0; width < 4; ++width){
+    vector<int64_t> vals = RandomVals(130, width, 1000000);
+    vector<uint8_t> bytes = Encode(vals, width);
+    for (int k = 0; k < num; ++k){
+      int64_t sum = 0;
+      for (size_t i = 0; i <= vals.size(); ++i){
+        ASSERT_EQ(sum, kernels[k]->sum[width](&bytes[0], i))
+          << kernels[k]->name << " width=" << width << " i=" << i;
+        if (i < vals.size()) sum += vals[i];
+      }
+    }
+  }
+}
+
+TEST(PrefixSumKernel, find){
+  int num = 0;
+  const PrefixSumKernel* const* kernels = SupportedKernels(num);
+  for (int width = 0; width < 4; ++width){
+    for (uint64_t n = 0; n <= 130; ++n){
+      vector<int64_t> vals(n);
+      int64_t total = 0;
+      for (size_t i = 0; i < n; ++i){
+        vals[i] = rand() % 5; // zeros included
+        total += vals[i];
+      }
+      vector<uint8_t> bytes = Encode(vals, width);
+      for (int64_t val = -1; val <= total + 1; ++val){
+        uint64_t expected = kernels[0]->find[width](&bytes[0], n, val);
+        for (int k = 1; k < num; ++k){
+          ASSERT_EQ(expected, kernels[k]->find[width](&bytes[0], n, val))
+            << kernels[k]->name << " width=" << width << " n=" << n << " val=" << val;
+        }
+      }
+    }
+  }
+  vector<int64_t> vals;
+  vals.push_back(2);
+  vals.push_back(0);
+  vals.push_back(3);
+  for (int width = 0; width < 4; ++width){
+    vector<uint8_t> bytes = Encode(vals, width);
+    for (int k = 0; k < num; ++k){
+      EXPECT_EQ(0, kernels[k]->find[width](&bytes[0], 3, 1));
+      EXPECT_EQ(2, kernels[k]->find[width](&bytes[0], 3, 2));
+      EXPECT_EQ(2, kernels[k]->find[width](&bytes[0], 3, 4));
+      EXPECT_EQ(3, kernels[k]->find[width](&bytes[0], 3, 5));
+    }
+  }
+}
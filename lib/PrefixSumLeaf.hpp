@@ -0,0 +1,194 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+  * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef PREFIXSUM_PREFIXSUM_LEAF_HPP_
+#define PREFIXSUM_PREFIXSUM_LEAF_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "PrefixSumKernel.hpp"
+
+namespace prefixsum {
+
+// A leaf holds at most kLeafMax values. A leaf that would drop below
+// kLeafMin is merged into its neighbor, so that every leaf but a lone
+// root holds at least kLeafMin values.
+const static uint64_t kLeafMax = 128;
+const static uint64_t kLeafMin = kLeafMax / 4;
+const static uint64_t kLeafGrow = 16;
+
+/**
+ * Block of consecutive values stored in a leaf of PrefixSum.
+ * The values are stored as signed integers of 2^width bytes, the
+ * smallest width that holds all of them, so small values take one or
+ * two bytes each. A value that does not fit widens the whole block;
+ * a block is narrowed again when it is split or rebuilt.
+ */
+struct PrefixSumLeaf{
+  explicit PrefixSumLeaf(int64_t parent) : parent(parent), sum(0), width(0) {}
+
+  uint64_t Num() const{
+    return bytes.size() >> width;
+  }
+
+  int64_t Get(uint64_t ind) const{
+    return Read(width, ind);
+  }
+
+  // Insert vs[0...num-1], whose sum is vs_sum, before the ind-th value
+  void Insert(uint64_t ind, const int64_t* vs, uint64_t num, int64_t vs_sum){
+    int new_width = width;
+    for (uint64_t i = 0; i < num; ++i){
+      new_width = MaxWidth(new_width, WidthOf(vs[i]));
+    }
+    Widen(new_width);
+    // grow by a few values at a time rather than doubling, which
+    // would leave a quarter of a block unused on average
+    uint64_t size = (Num() + num) << width;
+    if (size > bytes.capacity()){
+      bytes.reserve(size + (kLeafGrow << width));
+    }
+    bytes.insert(bytes.begin() + (ind << width), num << width, 0);
+    for (uint64_t i = 0; i < num; ++i){
+      Write(width, ind + i, vs[i]);
+    }
+    sum += vs_sum;
+  }
+
+  // Remove the ind-th value and return it
+  int64_t Erase(uint64_t ind){
+    int64_t val = Get(ind);
+    bytes.erase(bytes.begin() + (ind << width),
+                bytes.begin() + ((ind + 1) << width));
+    sum -= val;
+    return val;
+  }
+
+  void Add(uint64_t ind, int64_t val){
+    int64_t new_val = Get(ind) + val;
+    Widen(WidthOf(new_val));
+    Write(width, ind, new_val);
+    sum += val;
+  }
+
+  // Return the sum of the first ind values
+  int64_t GetPrefixSum(uint64_t ind) const{
+    return Kernel().sum[width](bytes.data(), ind);
+  }
+
+  // Return the first i s.t. val < vs[0] + ... + vs[i], or Num() if none
+  uint64_t Find(int64_t val) const{
+    return Kernel().find[width](bytes.data(), Num(), val);
+  }
+
+  // Store all values to vals
+  void Decode(std::vector<int64_t>& vals) const{
+    vals.resize(Num());
+    for (uint64_t i = 0; i < vals.size(); ++i){
+      vals[i] = Get(i);
+    }
+  }
+
+  // Move the values from the ind-th to the empty leaf other, and
+  // re-encode both halves with their own widths
+  void SplitTo(uint64_t ind, PrefixSumLeaf& other){
+    std::vector<int64_t> vals;
+    Decode(vals);
+    Assign(&vals[0], ind);
+    other.Assign(&vals[0] + ind, vals.size() - ind);
+  }
+
+  int64_t parent; // index of the parent node, -1 for the root
+  int64_t sum;    // sum of the values
+  int width;      // the values are 2^width bytes each
+  std::vector<uint8_t> bytes;
+
+private:
+  static int WidthOf(int64_t val){
+    if (val == static_cast<int8_t>(val)) return 0;
+    if (val == static_cast<int16_t>(val)) return 1;
+    if (val == static_cast<int32_t>(val)) return 2;
+    return 3;
+  }
+
+  static int MaxWidth(int x, int y){
+    return (x > y) ? x : y;
+  }
+
+  template <class T>
+  int64_t ReadAs(uint64_t ind) const{
+    T val;
+    memcpy(&val, &bytes[ind * sizeof(T)], sizeof(T));
+    return val;
+  }
+
+  template <class T>
+  void WriteAs(uint64_t ind, int64_t val){
+    T v = static_cast<T>(val);
+    memcpy(&bytes[ind * sizeof(T)], &v, sizeof(T));
+  }
+
+  int64_t Read(int w, uint64_t ind) const{
+    switch (w){
+    case 0: return ReadAs<int8_t>(ind);
+    case 1: return ReadAs<int16_t>(ind);
+    case 2: return ReadAs<int32_t>(ind);
+    default: return ReadAs<int64_t>(ind);
+    }
+  }
+
+  void Write(int w, uint64_t ind, int64_t val){
+    switch (w){
+    case 0: WriteAs<int8_t>(ind, val); break;
+    case 1: WriteAs<int16_t>(ind, val); break;
+    case 2: WriteAs<int32_t>(ind, val); break;
+    default: WriteAs<int64_t>(ind, val); break;
+    }
+  }
+
+  // Re-encode the values with 2^new_width bytes if that is wider.
+  // The values move back to front, so none is overwritten before read.
+  void Widen(int new_width){
+    if (new_width <= width) return;
+    uint64_t num = Num();
+    bytes.resize(num << new_width);
+    for (uint64_t i = num; i-- > 0; ){
+      Write(new_width, i, Read(width, i));
+    }
+    width = new_width;
+  }
+
+  // Replace the values with vs[0...num-1] in the narrowest width
+  void Assign(const int64_t* vs, uint64_t num){
+    bytes.clear();
+    width = 0;
+    sum = 0;
+    int64_t vs_sum = 0;
+    for (uint64_t i = 0; i < num; ++i){
+      vs_sum += vs[i];
+    }
+    Insert(0, vs, num, vs_sum);
+    std::vector<uint8_t>(bytes).swap(bytes);
+  }
+};
+
+} // namespace prefixsum
+
+#endif // PREFIXSUM_PREFIXSUM_LEAF_HPP_
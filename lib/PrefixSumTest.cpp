@@ -219,3 +219,175 @@ TEST(prefixsum, random2){
     sum += ps.GetPrefixSum(ind);
   }
 }
+
+TEST(PrefixSum, Delete){
+  PrefixSum ps;
+  ps.Insert(0, 1);
+  ps.Insert(1, 2);
+  ps.Insert(2, 3);
+  ps.Delete(1);
+  ASSERT_EQ(2, ps.Num());
+  EXPECT_EQ(1, ps.Get(0));
+  EXPECT_EQ(3, ps.Get(1));
+  EXPECT_EQ(4, ps.ValSum());
+  ps.Delete(1);
+  ps.Delete(0);
+  EXPECT_EQ(0, ps.Num());
+  EXPECT_EQ(0, ps.ValSum());
+  EXPECT_THROW(ps.Delete(0), out_of_range);
+  EXPECT_TRUE(ps.IsValid());
+}
+
+TEST(PrefixSum, DeleteRandom){
+  PrefixSum ps;
+  vector<int64_t> vals;
+  size_t max_num = 0;
+  for (int i = 0; i < 30000; ++i){
+    // grow to about 1000 values, then churn around that size
+    if (vals.empty() || rand() % 2000 >= static_cast<int>(vals.size())){
+      uint64_t ind = rand() % (vals.size() + 1);
+      int64_t val = rand() % 1000;
+      ps.Insert(ind, val);
+      vals.insert(vals.begin() + ind, val);
+    } else {
+      uint64_t ind = rand() % vals.size();
+      ps.Delete(ind);
+      vals.erase(vals.begin() + ind);
+    }
+    max_num = max(max_num, vals.size());
+    if (i % 1000 == 0){
+      ASSERT_TRUE(ps.IsValid()) << i;
+    }
+  }
+  ASSERT_TRUE(ps.IsValid());
+  ASSERT_EQ(vals.size(), ps.Num());
+  int64_t sum = 0;
+  for (size_t i = 0; i < vals.size(); ++i){
+    ASSERT_EQ(vals[i], ps.Get(i));
+    ASSERT_EQ(sum, ps.GetPrefixSum(i));
+    sum += vals[i];
+  }
+  EXPECT_EQ(sum, ps.ValSum());
+  // freed node slots are reused, so memory follows the peak size
+  EXPECT_LE(ps.NodeSlotNum(), max_num);
+}
+
+TEST(PrefixSum, Blocks){
+  PrefixSum ps;
+  vector<int64_t> vals;
+  uint64_t N = 10000;
+  for (uint64_t i = 0; i < N; ++i){
+    uint64_t ind = rand() % (vals.size() + 1);
+    int64_t val = rand() % 100 + 1;
+    ps.Insert(ind, val);
+    vals.insert(vals.begin() + ind, val);
+  }
+  ASSERT_TRUE(ps.IsValid());
+  // a split leaves two halves of kLeafMax / 2 values or more
+  EXPECT_LE(ps.LeafNum(), N / (kLeafMax / 2));
+
+  while (vals.size() > 100){
+    uint64_t ind = rand() % vals.size();
+    ps.Delete(ind);
+    vals.erase(vals.begin() + ind);
+  }
+  ASSERT_TRUE(ps.IsValid());
+  EXPECT_LE(ps.LeafNum(), vals.size() / kLeafMin);
+  int64_t sum = 0;
+  for (size_t i = 0; i < vals.size(); ++i){
+    ASSERT_EQ(vals[i], ps.Get(i));
+    ASSERT_EQ(sum, ps.GetPrefixSum(i));
+    ASSERT_EQ(i, ps.FindInPositiveValues(sum));
+    ASSERT_EQ(i, ps.FindInPositiveValues(sum + vals[i] - 1));
+    sum += vals[i];
+  }
+}
+
+TEST(PrefixSum, Widths){
+  PrefixSum ps;
+  vector<int64_t> vals;
+  uint64_t N = 10000;
+  for (uint64_t i = 0; i < N; ++i){
+    uint64_t ind = rand() % (vals.size() + 1);
+    int64_t val = rand() % 200 - 100;
+    ps.Insert(ind, val);
+    vals.insert(vals.begin() + ind, val);
+  }
+  // one byte per value, plus the nodes and the leaf headers
+  EXPECT_LT(ps.ByteSize(), 4 * N);
+
+  // widen blocks to 2, 4 and 8 bytes, and narrow them back by Set
+  int64_t bigs[] = {1000, -40000, 3000000000LL, -(1LL << 40)};
+  for (uint64_t i = 0; i < 1000; ++i){
+    uint64_t ind = rand() % N;
+    int64_t val = bigs[rand() % 4];
+    if (rand() % 2){
+      ps.Set(ind, val);
+    } else {
+      ps.Add(ind, val);
+      val += vals[ind];
+    }
+    vals[ind] = val;
+  }
+  for (uint64_t i = 0; i < 1000; ++i){
+    uint64_t ind = rand() % (vals.size() + 1);
+    int64_t val = bigs[rand() % 4];
+    ps.Insert(ind, val);
+    vals.insert(vals.begin() + ind, val);
+  }
+  ASSERT_TRUE(ps.IsValid());
+  int64_t sum = 0;
+  for (size_t i = 0; i < vals.size(); ++i){
+    ASSERT_EQ(vals[i], ps.Get(i)) << i;
+    ASSERT_EQ(sum, ps.GetPrefixSum(i)) << i;
+    sum += vals[i];
+  }
+  ASSERT_EQ(sum, ps.ValSum());
+}
+
+TEST(PrefixSum, Batch){
+  PrefixSum ps;
+  vector<uint64_t> inds(1, 0);
+  vector<int64_t> vals(1, 0);
+  vector<int64_t> sums(1, -1);
+  vector<uint64_t> founds(1, 7);
+  ps.GetPrefixSumBatch(&inds[0], 1, &sums[0]);
+  EXPECT_EQ(0, sums[0]);
+  ps.FindBatch(&vals[0], 1, &founds[0]);
+  EXPECT_EQ(0, founds[0]);
+  // negative values on an empty tree
+  int64_t negs[] = {-1, 0, -5};
+  uint64_t negs_founds[] = {7, 7, 7};
+  ps.FindBatch(negs, 3, negs_founds);
+  for (int i = 0; i < 3; ++i){
+    EXPECT_EQ(0, negs_founds[i]) << i;
+    EXPECT_EQ(0, ps.FindInPositiveValues(negs[i])) << i;
+  }
+
+  uint64_t N = 20000;
+  for (uint64_t i = 0; i < N; ++i){
+    ps.Insert(rand() % (i + 1), rand() % 1000 + 1);
+  }
+  uint64_t query_num = 1000;
+  inds.resize(query_num);
+  vals.resize(query_num);
+  for (uint64_t i = 0; i < query_num; ++i){
+    inds[i] = rand() % (N + 1);
+    vals[i] = rand() % (ps.ValSum() + 10) - 5;
+  }
+  inds[0] = N;
+  vals[1] = ps.ValSum();
+  // n not a multiple of the group size
+  for (uint64_t n = query_num - 3; n <= query_num; n += 3){
+    sums.assign(n, -1);
+    founds.assign(n, 0);
+    ps.GetPrefixSumBatch(&inds[0], n, &sums[0]);
+    ps.FindBatch(&vals[0], n, &founds[0]);
+    for (uint64_t i = 0; i < n; ++i){
+      ASSERT_EQ(ps.GetPrefixSum(inds[i]), sums[i]) << i;
+      ASSERT_EQ(ps.FindInPositiveValues(vals[i]), founds[i]) << i;
+    }
+  }
+  inds[5] = N + 1;
+  EXPECT_THROW(ps.GetPrefixSumBatch(&inds[0], query_num, &sums[0]), out_of_range);
+}
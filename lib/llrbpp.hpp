@@ -21,53 +21,570 @@
 #define LLRBPP_LLRBPP_HPP_
 
 #include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
+#include "llrbppCompare.hpp"
 #include "llrbppNode.hpp"
+#include "llrbppPool.hpp"
 
 namespace llrbpp{
 
-template <class Key, class Val, class Comp = std::less<Key> >
+/**
+ * Left-Leaning Red-Black Tree
+ * Alloc is instantiated with the node type and provides node storage
+ * (see llrbppPool.hpp). The default NodePool draws nodes from contiguous
+ * slabs so that Clear() and the destructor release them in bulk.
+ * Aug selects the per-node augmentation (see llrbppAugment.hpp); with
+ * SizeAugment the tree supports Rank, Select and CountInRange, and with
+ * MonoidAugment also Aggregate and AggregateByPosition.
+ * Keys are compared by Comp only. If Comp also provides a three-way
+ * Compare (see llrbppCompare.hpp, e.g. StringCompare), each level of a
+ * search costs one key comparison.
+ */
+template <class Key, class Val, class Comp = std::less<Key>,
+          template <class> class Alloc = NodePool,
+          class Aug = NoAugment>
 class LLRBPP{
+  typedef Node<Key, Val, Aug> NodeType;
+
+  // The height of a LLRB tree is at most 2 log_2 (num + 1)
+  static const int kMaxHeight = 128;
+
+  // Smaller batches are applied key by key: their search paths share
+  // too little to pay for the joins.
+  static const uint64_t kBatchJoinMin = 16;
+
+  // FindBatch advances this many searches in lockstep; enough misses
+  // in flight to cover the memory latency, few enough to stay in
+  // registers and the line fill buffers.
+  static const size_t kFindGroup = 16;
+
 public:
+  /**
+   * Bidirectional iterator over the entries in key order.
+   * It keeps the path from the root on a fixed-size stack, so it does not
+   * allocate and each step costs amortized O(1). Any Insert or Delete
+   * invalidates all iterators.
+   */
+  class Iterator{
+  public:
+    Iterator() : root_(NULL), depth_(0){
+    }
+
+    const Key& GetKey() const{
+      return path_[depth_-1]->key;
+    }
+
+    const Val& GetVal() const{
+      return path_[depth_-1]->val;
+    }
+
+    Iterator& operator++(){
+      const NodeType* node = path_[depth_-1];
+      if (node->right != NULL){
+        PushLeftMost(node->right);
+      } else {
+        --depth_;
+        while (depth_ > 0 && path_[depth_-1]->right == node){
+          node = path_[--depth_];
+        }
+      }
+      return *this;
+    }
+
+    Iterator& operator--(){
+      if (depth_ == 0){
+        // End() -> the last entry
+        PushRightMost(root_);
+        return *this;
+      }
+      const NodeType* node = path_[depth_-1];
+      if (node->left != NULL){
+        PushRightMost(node->left);
+      } else {
+        --depth_;
+        while (depth_ > 0 && path_[depth_-1]->left == node){
+          node = path_[--depth_];
+        }
+      }
+      return *this;
+    }
+
+    bool operator==(const Iterator& it) const{
+      if (depth_ != it.depth_) return false;
+      return depth_ == 0 || path_[depth_-1] == it.path_[depth_-1];
+    }
+
+    bool operator!=(const Iterator& it) const{
+      return !(*this == it);
+    }
+
+  private:
+    friend class LLRBPP;
+
+    explicit Iterator(const NodeType* root) : root_(root), depth_(0){
+    }
+
+    void PushLeftMost(const NodeType* node){
+      for (; node != NULL; node = node->left){
+        path_[depth_++] = node;
+      }
+    }
+
+    void PushRightMost(const NodeType* node){
+      for (; node != NULL; node = node->right){
+        path_[depth_++] = node;
+      }
+    }
+
+    const NodeType* root_;
+    const NodeType* path_[kMaxHeight];
+    int depth_;
+  };
+
   LLRBPP() : root_(NULL), num_(0){
   }
 
   ~LLRBPP(){
-    delete root_;
+    Clear();
   }
 
-  void Insert(Key key, Val val){
-    root_ = InsertInternal(root_, key, val);
-    root_->color = kBLACK;
+  // Insert (key, val), or assign val if key exists.
+  template <class V>
+  void Insert(const Key& key, V&& val){
+    InsertUnique(key,
+                 [&](NodeType* node){
+                   node->val = std::forward<V>(val);
+                   return true;
+                 },
+                 [&](){ return NewNode(key, std::forward<V>(val)); });
+  }
+
+  template <class V>
+  void Insert(Key&& key, V&& val){
+    InsertUnique(key,
+                 [&](NodeType* node){
+                   node->val = std::forward<V>(val);
+                   return true;
+                 },
+                 [&](){ return NewNode(std::move(key), std::forward<V>(val)); });
+  }
+
+  /**
+   * Build an entry in place, the key from key_arg and the value from
+   * val_args, and insert it unless its key exists. Return true iff
+   * inserted. The entry is built before the search, so use TryEmplace
+   * when the key is at hand.
+   */
+  template <class KeyArg, class... ValArgs>
+  bool Emplace(KeyArg&& key_arg, ValArgs&&... val_args){
+    NodeType* node = NewNode(std::forward<KeyArg>(key_arg),
+                             std::forward<ValArgs>(val_args)...);
+    bool inserted = InsertUnique(node->key,
+                                 [](NodeType*){ return false; },
+                                 [node](){ return node; });
+    if (!inserted){
+      DeleteNode(node);
+    }
+    return inserted;
+  }
+
+  // Insert key with a value built from val_args in place if key does not
+  // exist; otherwise nothing is built or moved. Return true iff inserted.
+  template <class... ValArgs>
+  bool TryEmplace(const Key& key, ValArgs&&... val_args){
+    return InsertUnique(key,
+                        [](NodeType*){ return false; },
+                        [&](){
+                          return NewNode(key, std::forward<ValArgs>(val_args)...);
+                        });
+  }
+
+  template <class... ValArgs>
+  bool TryEmplace(Key&& key, ValArgs&&... val_args){
+    return InsertUnique(key,
+                        [](NodeType*){ return false; },
+                        [&](){
+                          return NewNode(std::move(key),
+                                         std::forward<ValArgs>(val_args)...);
+                        });
   }
 
-  void Delete(Key key){
-    root_ = DeleteInternal(root_, key);
+  void Delete(const Key& key){
+    if (root_ == NULL) return;
+    if (!IsRED(root_->left) && !IsRED(root_->right)){
+      root_->color = kRED;
+    }
+    root_ = DeleteTopDown(key);
     if (root_ != NULL){
       root_->color = kBLACK;
     }
-    --num_;
   }
 
   void Clear(){
-    delete root_;
+    // storage shared with another tree keeps the nodes of this one
+    // unless they are passed back one by one
+    bool bulk = alloc_.Exclusive();
+    if (!bulk || !std::is_trivially_destructible<NodeType>::value){
+      DestroyInternal(root_, !bulk);
+    }
+    alloc_.Release();
     root_ = NULL;
     num_ = 0;
   }
 
+  /**
+   * Replace the contents with the (key, val) pairs in [begin, end),
+   * which must be sorted by strictly increasing keys. The tree is built
+   * directly in O(n), and nodes are allocated in key order.
+   */
+  template <class ForwardIterator>
+  void BuildFromSorted(ForwardIterator begin, ForwardIterator end){
+    Clear();
+    uint64_t num = std::distance(begin, end);
+    SortedSource<ForwardIterator> source(*this, begin);
+    root_ = BuildInternal(num, BlackHeightFor(num), source);
+    if (root_ != NULL){
+      root_->color = kBLACK;
+    }
+  }
+
+  /**
+   * Insert the (key, val) pairs in [begin, end), sorted by strictly
+   * increasing keys; existing keys get the new values. The batch is split
+   * at each node on the way down and the subtrees are joined back through
+   * the node, so the keys share their search paths and the cost is
+   * O(k log(n/k + 1)); an empty tree is built in O(k).
+   */
+  template <class ForwardIterator>
+  void InsertBatch(ForwardIterator begin, ForwardIterator end){
+    if (static_cast<uint64_t>(std::distance(begin, end)) < kBatchJoinMin){
+      for (; begin != end; ++begin){
+        Insert(begin->first, begin->second);
+      }
+      return;
+    }
+    int height = 0;
+    root_ = UnionInternal(root_, BlackHeight(root_), begin, end, height);
+  }
+
+  /**
+   * Delete the keys in [begin, end), sorted in increasing order, by
+   * splitting and joining as in InsertBatch.
+   */
+  template <class ForwardIterator>
+  void DeleteBatch(ForwardIterator begin, ForwardIterator end){
+    if (static_cast<uint64_t>(std::distance(begin, end)) < kBatchJoinMin){
+      for (; begin != end; ++begin){
+        Delete(*begin);
+      }
+      return;
+    }
+    int height = 0;
+    root_ = DifferenceInternal(root_, BlackHeight(root_), begin, end, height);
+  }
+
+  /**
+   * Move the entries with keys not less than key into upper, whose
+   * previous contents are discarded. The tree is cut along the search
+   * path of key and the pieces are joined by black height, in O(log n).
+   * Num() of both trees is then read from subtree sizes if Aug has them,
+   * and otherwise counted in O(min(#lower, #upper)).
+   * Nodes stay where they are: upper shares the storage of this tree.
+   */
+  void Split(const Key& key, LLRBPP& upper){
+    if (&upper == this) return;
+    upper.Clear();
+    upper.alloc_.Share(alloc_);
+    NodeType* lower_root = NULL;
+    NodeType* upper_root = NULL;
+    int lower_height = 0;
+    int upper_height = 0;
+    SplitInternal(root_, BlackHeight(root_), key,
+                  lower_root, lower_height, upper_root, upper_height);
+    uint64_t lower_num = LowerNum(lower_root, upper_root,
+                                  std::integral_constant<bool, Aug::kHasSize>());
+    upper.root_ = upper_root;
+    upper.num_ = num_ - lower_num;
+    root_ = lower_root;
+    num_ = lower_num;
+  }
+
+  /**
+   * Move every entry of upper into this tree and leave upper empty.
+   * All keys of upper must be greater than the keys of this tree;
+   * otherwise std::invalid_argument is thrown and both trees are kept.
+   * The smallest node of upper is unlinked and used as the pivot joining
+   * the two trees at the same black height, in O(log n).
+   */
+  void Join(LLRBPP& upper){
+    if (&upper == this || upper.root_ == NULL) return;
+    if (root_ != NULL && !Comp()(MaxNode(root_)->key, MinNode(upper.root_)->key)){
+      throw std::invalid_argument("LLRBPP::Join overlapping keys");
+    }
+    alloc_.Share(upper.alloc_);
+    uint64_t num = num_ + upper.num_;
+    if (root_ == NULL){
+      root_ = upper.root_;
+    } else {
+      NodeType* pivot = upper.DetachMin();
+      int height = 0;
+      root_ = Join3(root_, BlackHeight(root_), pivot,
+                    upper.root_, BlackHeight(upper.root_), height);
+    }
+    num_ = num;
+    upper.root_ = NULL;
+    upper.num_ = 0;
+    upper.alloc_.Release();
+  }
+
   // Return (true, value) if key exists and (false, Val()) otherwise.
-  std::pair<bool, Val> Find(Key key) const{
-    Node<Key, Val>* node = root_;
+  std::pair<bool, Val> Find(const Key& key) const{
+    const NodeType* node = FindNode(key);
+    if (node == NULL) return std::make_pair(false, Val());
+    return std::make_pair(true, node->val);
+  }
+
+  /**
+   * Return a pointer to the value of key, or NULL if key does not exist.
+   * The pointer stays valid until the entry is deleted. Values are
+   * changed through UpdateInPlace so that augmentations stay consistent.
+   * The overloads taking K are enabled when Comp is transparent (has
+   * is_transparent, as std::less<>), so that e.g. a std::string_view
+   * probes std::string keys without building a std::string.
+   */
+  const Val* FindPtr(const Key& key) const{
+    const NodeType* node = FindNode(key);
+    return (node == NULL) ? NULL : &node->val;
+  }
+
+  template <class K, class C = Comp, class = typename C::is_transparent>
+  const Val* FindPtr(const K& key) const{
+    const NodeType* node = FindNode(key);
+    return (node == NULL) ? NULL : &node->val;
+  }
+
+  bool Contains(const Key& key) const{
+    return FindNode(key) != NULL;
+  }
+
+  /**
+   * Set out[i] to FindPtr(keys[i]) for i in [0, n).
+   * The searches run kFindGroup at a time, advancing one level per
+   * round and prefetching the next node of each, so that a group waits
+   * for its cache misses together rather than one after another.
+   * Much faster than a loop of FindPtr on trees exceeding the cache.
+   */
+  void FindBatch(const Key* keys, size_t n, const Val** out) const{
+    for (size_t i = 0; i < n; i += kFindGroup){
+      FindGroup(keys + i, (n - i < kFindGroup) ? n - i : kFindGroup, out + i);
+    }
+  }
+
+  template <class K, class C = Comp, class = typename C::is_transparent>
+  bool Contains(const K& key) const{
+    return FindNode(key) != NULL;
+  }
+
+  // Call fn(val) on the value of key and return true, or return false
+  // if key does not exist.
+  template <class Fn>
+  bool UpdateInPlace(const Key& key, Fn fn){
+    return UpdateInPlaceInternal(key, fn);
+  }
+
+  template <class K, class Fn, class C = Comp, class = typename C::is_transparent>
+  bool UpdateInPlace(const K& key, Fn fn){
+    return UpdateInPlaceInternal(key, fn);
+  }
+
+  // Return the iterator pointing to the smallest key.
+  Iterator Begin() const{
+    Iterator it(root_);
+    it.PushLeftMost(root_);
+    return it;
+  }
+
+  Iterator End() const{
+    return Iterator(root_);
+  }
+
+  // Return the iterator pointing to the first key not less than key.
+  Iterator LowerBound(const Key& key) const{
+    Iterator it(root_);
+    int bound_depth = 0;
+    for (const NodeType* node = root_; node != NULL; ){
+      it.path_[it.depth_++] = node;
+      if (Comp()(node->key, key)){
+        node = node->right;
+      } else {
+        bound_depth = it.depth_;
+        node = node->left;
+      }
+    }
+    it.depth_ = bound_depth;
+    return it;
+  }
+
+  // Return the iterator pointing to the first key greater than key.
+  Iterator UpperBound(const Key& key) const{
+    Iterator it(root_);
+    int bound_depth = 0;
+    for (const NodeType* node = root_; node != NULL; ){
+      it.path_[it.depth_++] = node;
+      if (Comp()(key, node->key)){
+        bound_depth = it.depth_;
+        node = node->left;
+      } else {
+        node = node->right;
+      }
+    }
+    it.depth_ = bound_depth;
+    return it;
+  }
+
+  // Call fn(key, val) for every key in [lo, hi) in ascending order.
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    for (Iterator it = LowerBound(lo); it != End(); ++it){
+      if (!Comp()(it.GetKey(), hi)) break;
+      fn(it.GetKey(), it.GetVal());
+    }
+  }
+
+  // Return the number of keys less than key. Requires SizeAugment.
+  uint64_t Rank(const Key& key) const{
+    uint64_t rank = 0;
+    for (const NodeType* node = root_; node != NULL; ){
+      if (Comp()(node->key, key)){
+        rank += Aug::Size(node->left) + 1;
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return rank;
+  }
+
+  // Return the iterator pointing to the k-th smallest key (0-origin),
+  // or End() if k >= Num(). Requires SizeAugment.
+  Iterator Select(uint64_t k) const{
+    Iterator it(root_);
+    if (k >= num_) return it;
+    for (const NodeType* node = root_; ; ){
+      it.path_[it.depth_++] = node;
+      uint64_t left_size = Aug::Size(node->left);
+      if (k < left_size){
+        node = node->left;
+      } else if (k == left_size){
+        return it;
+      } else {
+        k -= left_size + 1;
+        node = node->right;
+      }
+    }
+  }
+
+  // Return the number of keys in [lo, hi). Requires SizeAugment.
+  uint64_t CountInRange(const Key& lo, const Key& hi) const{
+    if (!Comp()(lo, hi)) return 0;
+    return Rank(hi) - Rank(lo);
+  }
+
+  // Return the aggregate of the entries whose keys are in [lo, hi),
+  // combined in key order. Requires MonoidAugment.
+  template <class A = Aug>
+  typename A::Value Aggregate(const Key& lo, const Key& hi) const{
+    typedef typename A::Monoid M;
+    const NodeType* node = root_;
     while (node != NULL){
-      if (key == node->key){
-        return std::make_pair(true, node->val);
-      } else if (Comp()(key, node->key)){
+      if (!Comp()(node->key, hi)){
         node = node->left;
+      } else if (Comp()(node->key, lo)){
+        node = node->right;
       } else {
+        break;
+      }
+    }
+    if (node == NULL) return M::Identity();
+
+    // node is in [lo, hi): collect keys >= lo on its left
+    // and keys < hi on its right.
+    typename A::Value left_agg = M::Identity();
+    for (const NodeType* h = node->left; h != NULL; ){
+      if (Comp()(h->key, lo)){
+        h = h->right;
+      } else {
+        left_agg = M::Combine(M::Combine(A::Lift(h), A::Agg(h->right)), left_agg);
+        h = h->left;
+      }
+    }
+    typename A::Value right_agg = M::Identity();
+    for (const NodeType* h = node->right; h != NULL; ){
+      if (Comp()(h->key, hi)){
+        right_agg = M::Combine(right_agg, M::Combine(A::Agg(h->left), A::Lift(h)));
+        h = h->right;
+      } else {
+        h = h->left;
+      }
+    }
+    return M::Combine(M::Combine(left_agg, A::Lift(node)), right_agg);
+  }
+
+  // Return the aggregate of the begin-th, ..., (end-1)-th smallest
+  // entries (0-origin). Requires MonoidAugment.
+  template <class A = Aug>
+  typename A::Value AggregateByPosition(uint64_t begin, uint64_t end) const{
+    typedef typename A::Monoid M;
+    if (end > num_) end = num_;
+    if (begin >= end) return M::Identity();
+    const NodeType* node = root_;
+    for (;;){
+      uint64_t left_size = A::Size(node->left);
+      if (end <= left_size){
+        node = node->left;
+      } else if (begin > left_size){
+        begin -= left_size + 1;
+        end -= left_size + 1;
         node = node->right;
+      } else {
+        break;
+      }
+    }
+
+    // node is the (left_size)-th entry of its subtree and lies in
+    // [begin, end): take the last (left_size - begin) entries on its left
+    // and the first (end - left_size - 1) entries on its right.
+    typename A::Value left_agg = M::Identity();
+    uint64_t skip = begin;
+    for (const NodeType* h = node->left; h != NULL; ){
+      uint64_t left_size = A::Size(h->left);
+      if (skip > left_size){
+        skip -= left_size + 1;
+        h = h->right;
+      } else {
+        left_agg = M::Combine(M::Combine(A::Lift(h), A::Agg(h->right)), left_agg);
+        h = h->left;
       }
     }
-    return std::make_pair(false, Val());
+    typename A::Value right_agg = M::Identity();
+    uint64_t take = end - A::Size(node->left) - 1;
+    for (const NodeType* h = node->right; h != NULL && take > 0; ){
+      uint64_t left_size = A::Size(h->left);
+      if (take > left_size){
+        right_agg = M::Combine(right_agg, M::Combine(A::Agg(h->left), A::Lift(h)));
+        take -= left_size + 1;
+        h = h->right;
+      } else {
+        h = h->left;
+      }
+    }
+    return M::Combine(M::Combine(left_agg, A::Lift(node)), right_agg);
   }
 
   int DepthSum() const{
@@ -82,14 +599,67 @@ public:
     return num_;
   }
 
+  const Alloc<NodeType>& GetAllocator() const{
+    return alloc_;
+  }
+
+  // Return true iff the tree is a valid left-leaning red-black tree.
+  bool IsValid() const{
+    if (IsRED(root_)) return false;
+    uint64_t num = 0;
+    return IsValidInternal(root_, NULL, NULL, num) >= 0 && num == num_;
+  }
+
 private:
-  bool IsRED(Node<Key, Val>* h) const {
+  template <class... Args>
+  NodeType* NewNode(Args&&... args){
+    NodeType* node = alloc_.Allocate();
+    try {
+      new (node) NodeType(std::forward<Args>(args)...);
+    } catch (...) {
+      alloc_.Deallocate(node);
+      throw;
+    }
+    Aug::Update(node);
+    ++num_;
+    return node;
+  }
+
+  void DeleteNode(NodeType* node){
+    node->~NodeType();
+    alloc_.Deallocate(node);
+    --num_;
+  }
+
+  // Destroy every node of h without recursion, and deallocate them if
+  // deallocate. The stack holds pending right subtrees; its depth is
+  // bounded by the tree height.
+  void DestroyInternal(NodeType* h, bool deallocate){
+    NodeType* stack[kMaxHeight];
+    int depth = 0;
+    while (h != NULL || depth > 0){
+      if (h == NULL){
+        h = stack[--depth];
+      }
+      NodeType* left = h->left;
+      if (h->right != NULL){
+        stack[depth++] = h->right;
+      }
+      h->~NodeType();
+      if (deallocate){
+        alloc_.Deallocate(h);
+      }
+      h = left;
+    }
+  }
+
+  bool IsRED(const NodeType* h) const {
     // IsRED is true iff h is not NULL and h is RED
     if (h == NULL) return false;
     return h->color == kRED;
   }
 
-  void FlipColor(Node<Key, Val>* x){
+  void FlipColor(NodeType* x){
     // assert(x->left != NULL) && assert(x->right)
     x->color = !x->color;
     if (x->left != NULL){
@@ -100,54 +670,273 @@ private:
     }
   }
 
-  Node<Key, Val>* RotateLeft(Node<Key, Val>* h){
-    Node<Key, Val>* x = h->right;
+  NodeType* RotateLeft(NodeType* h){
+    NodeType* x = h->right;
     h->right = x->left;
     x->left = h;
     x->color = x->left->color;
     x->left->color = kRED;
+    Aug::Update(h);
+    Aug::Update(x);
     return x;
   }
 
-  Node<Key, Val>* RotateRight(Node<Key, Val>* h){
-    Node<Key, Val>* x = h->left;
+  NodeType* RotateRight(NodeType* h){
+    NodeType* x = h->left;
     h->left = x->right;
     x->right = h;
     x->color = x->right->color;
     x->right->color = kRED;
+    Aug::Update(h);
+    Aug::Update(x);
     return x;
   }
 
-  Node<Key, Val>* InsertInternal(Node<Key, Val>* h, Key key, Val val){
-    if (h == NULL){
-      ++num_;
-      return new Node<Key, Val>(key, val);
+  template <class ForwardIterator>
+  class SortedSource{
+  public:
+    SortedSource(LLRBPP& tree, ForwardIterator it) : tree_(tree), it_(it){
     }
-    
-    if (IsRED(h->left) && IsRED(h->right)){
-      FlipColor(h);
+
+    NodeType* Next(){
+      NodeType* node = tree_.NewNode(it_->first, it_->second);
+      ++it_;
+      return node;
     }
 
-    if (key == h->key){
-      h->val = val;
-    } else if (Comp()(key, h->key)){
-      h->left = InsertInternal(h->left, key, val);
+  private:
+    LLRBPP& tree_;
+    ForwardIterator it_;
+  };
+
+  // A subtree of black height h holds between 2^h - 1 and 3^h - 1 keys.
+  static uint64_t MaxNumForBlackHeight(int height){
+    uint64_t num = 1;
+    for (int i = 0; i < height; ++i){
+      if (num > UINT64_MAX / 3) return UINT64_MAX;
+      num *= 3;
+    }
+    return num - 1;
+  }
+
+  static int BlackHeightFor(uint64_t num){
+    int height = 0;
+    while (height < 63 && (2ULL << height) - 1 <= num){
+      ++height;
+    }
+    return height;
+  }
+
+  // Build a subtree of black height height holding the next num nodes of
+  // source in order. Each node becomes a 2-node (black) or a 3-node
+  // (black with a red left child) of the underlying 2-3 tree.
+  template <class Source>
+  NodeType* BuildInternal(uint64_t num, int height, Source& source){
+    if (num == 0) return NULL;
+    uint64_t max_child = MaxNumForBlackHeight(height - 1);
+    NodeType* h;
+    if (num / 2 <= max_child){
+      uint64_t left_num = (num - 1) / 2;
+      NodeType* left = BuildInternal(left_num, height - 1, source);
+      h = source.Next();
+      h->left = left;
+      h->right = BuildInternal(num - 1 - left_num, height - 1, source);
     } else {
-      h->right = InsertInternal(h->right, key, val);
+      uint64_t rest = num - 2;
+      uint64_t a = rest / 3;
+      uint64_t b = (rest - a) / 2;
+      NodeType* left = BuildInternal(a, height - 1, source);
+      NodeType* red = source.Next();
+      red->color = kRED;
+      red->left = left;
+      red->right = BuildInternal(b, height - 1, source);
+      Aug::Update(red);
+      h = source.Next();
+      h->left = red;
+      h->right = BuildInternal(rest - a - b, height - 1, source);
     }
-    
-    if (IsRED(h->right)){
-      h = RotateLeft(h);
+    h->color = kBLACK;
+    Aug::Update(h);
+    return h;
+  }
+
+  // With a cheap three-way comparison the search stops at the key.
+  // Otherwise it descends to the first key not less than key with one
+  // Comp call per level and tests that candidate for equality at the end.
+  template <class K>
+  const NodeType* FindNode(const K& key) const{
+    typedef ThreeWay<Comp, K, Key> Cmp;
+    if (Cmp::kEnabled){
+      for (const NodeType* node = root_; node != NULL; ){
+        int cmp = Cmp::Compare(key, node->key);
+        if (cmp == 0) return node;
+        node = (cmp < 0) ? node->left : node->right;
+      }
+      return NULL;
+    }
+    const NodeType* cand = NULL;
+    for (const NodeType* node = root_; node != NULL; ){
+      if (Comp()(node->key, key)){
+        node = node->right;
+      } else {
+        cand = node;
+        node = node->left;
+      }
     }
+    if (cand == NULL || Comp()(key, cand->key)) return NULL;
+    return cand;
+  }
 
-    if (IsRED(h->left) && IsRED(h->left->left)){
-      h = RotateRight(h);
+  // FindBatch for n <= kFindGroup keys. The descents defer the
+  // equality test to the end so that each level is a single branch-free
+  // step.
+  void FindGroup(const Key* keys, size_t n, const Val** out) const{
+    const NodeType* node[kFindGroup];
+    const NodeType* cand[kFindGroup];
+    for (size_t j = 0; j < n; ++j){
+      node[j] = root_;
+      cand[j] = NULL;
+    }
+    for (size_t active = n; active > 0; ){
+      active = 0;
+      for (size_t j = 0; j < n; ++j){
+        const NodeType* h = node[j];
+        if (h == NULL) continue;
+        bool to_right = Comp()(h->key, keys[j]);
+        cand[j] = to_right ? cand[j] : h;
+        h = to_right ? h->right : h->left;
+        __builtin_prefetch(h);
+        node[j] = h;
+        active += (h != NULL);
+      }
     }
+    for (size_t j = 0; j < n; ++j){
+      bool found = cand[j] != NULL && !Comp()(keys[j], cand[j]->key);
+      out[j] = found ? &cand[j]->val : NULL;
+    }
+  }
 
-    return h;
+  // Search key as FindNode, recording the visited nodes and directions.
+  // Return the node holding key with its ancestors in path[0, depth), or
+  // NULL with the path to the position where key would be linked.
+  template <class K>
+  NodeType* SearchPath(const K& key, NodeType** path, bool* to_left,
+                       int& depth){
+    typedef ThreeWay<Comp, K, Key> Cmp;
+    depth = 0;
+    if (Cmp::kEnabled){
+      for (NodeType* h = root_; h != NULL; ++depth){
+        int cmp = Cmp::Compare(key, h->key);
+        if (cmp == 0) return h;
+        path[depth] = h;
+        to_left[depth] = (cmp < 0);
+        h = (cmp < 0) ? h->left : h->right;
+      }
+      return NULL;
+    }
+    NodeType* cand = NULL;
+    int cand_depth = 0;
+    for (NodeType* h = root_; h != NULL; ++depth){
+      path[depth] = h;
+      to_left[depth] = !Comp()(h->key, key);
+      if (to_left[depth]){
+        cand = h;
+        cand_depth = depth;
+      }
+      h = to_left[depth] ? h->left : h->right;
+    }
+    if (cand == NULL || Comp()(key, cand->key)) return NULL;
+    depth = cand_depth;
+    return cand;
+  }
+
+  template <class K, class Fn>
+  bool UpdateInPlaceInternal(const K& key, Fn& fn){
+    NodeType* path[kMaxHeight];
+    bool to_left[kMaxHeight];
+    int depth = 0;
+    NodeType* h = SearchPath(key, path, to_left, depth);
+    if (h == NULL) return false;
+    fn(h->val);
+    if (Aug::kEnabled){
+      Aug::Update(h);
+      UpdatePath(path, depth);
+    }
+    return true;
+  }
+
+  // Find key, or link the node returned by make() in its place and
+  // return true. If key exists, on_found(node) is called instead and the
+  // augmentation on the path is refreshed if it returns true.
+  template <class OnFound, class Make>
+  bool InsertUnique(const Key& key, OnFound on_found, Make make){
+    if (root_ == NULL){
+      root_ = make();
+      root_->color = kBLACK;
+      return true;
+    }
+    NodeType* path[kMaxHeight];
+    bool to_left[kMaxHeight];
+    int depth = 0;
+    NodeType* h = SearchPath(key, path, to_left, depth);
+    if (h != NULL){
+      if (on_found(h) && Aug::kEnabled){
+        Aug::Update(h);
+        UpdatePath(path, depth);
+      }
+      return false;
+    }
+    root_ = InsertFixUp(path, to_left, depth, make());
+    root_->color = kBLACK;
+    return true;
+  }
+
+  void UpdatePath(NodeType** path, int depth){
+    while (depth > 0){
+      Aug::Update(path[--depth]);
+    }
+  }
+
+  // Link the new subtree child below path[depth-1] and restore the LLRB
+  // invariants bottom-up. Links are stored only when they change, and the
+  // walk stops once two consecutive levels are left untouched since no
+  // ancestor can observe a difference beyond that point.
+  NodeType* InsertFixUp(NodeType** path, const bool* to_left, int depth,
+                        NodeType* child){
+    bool child_changed = true;
+    while (depth > 0){
+      NodeType* h = path[--depth];
+      bool changed = false;
+      NodeType*& link = to_left[depth] ? h->left : h->right;
+      if (link != child){
+        link = child;
+        changed = true;
+      }
+      Aug::Update(h);
+      if (IsRED(h->right) && !IsRED(h->left)){
+        h = RotateLeft(h);
+        changed = true;
+      }
+      if (IsRED(h->left) && IsRED(h->left->left)){
+        h = RotateRight(h);
+        changed = true;
+      }
+      // Split 4-nodes on the way up (2-3 variant) so that Delete never
+      // meets a 4-node.
+      if (IsRED(h->left) && IsRED(h->right)){
+        FlipColor(h);
+        changed = true;
+      }
+      if (!changed && !child_changed && !Aug::kEnabled){
+        return root_;
+      }
+      child = h;
+      child_changed = changed;
+    }
+    return child;
   }
 
-  Node<Key, Val>* MoveREDLeft(Node<Key, Val>* h){
+  NodeType* MoveREDLeft(NodeType* h){
     FlipColor(h);
     if (h->right != NULL && IsRED(h->right->left)){
       h->right = RotateRight(h->right);
@@ -157,7 +946,7 @@ private:
     return h;
   }
 
-  Node<Key, Val>* MoveREDRight(Node<Key, Val>* h){
+  NodeType* MoveREDRight(NodeType* h){
     FlipColor(h);
     if (h->left != NULL && IsRED(h->left->left)){
       h = RotateRight(h);
@@ -166,7 +955,7 @@ private:
     return h;
   }
 
-  Node<Key, Val>* FixUp(Node<Key, Val>* h){
+  NodeType* FixUp(NodeType* h){
     if (IsRED(h->right)){
       h = RotateLeft(h);
     }
@@ -179,81 +968,400 @@ private:
     return h;
   }
 
-  Node<Key, Val>* DeleteMin(Node<Key, Val>* h){
-    if (h->left == NULL){
-      return NULL;
+  // Top-down LLRB deletion. The descent applies the same transformations
+  // as the recursive formulation and records the visited nodes, then
+  // FixUp is applied bottom-up, storing links only when they change.
+  // It makes one Comp call per level: the last node left to the right
+  // is the only one that can hold key, and if it does, every later step
+  // goes left, down to the minimum of its right subtree. That minimum is
+  // relinked in its place, so no key or value is copied.
+  NodeType* DeleteTopDown(const Key& key){
+    NodeType* path[kMaxHeight];
+    bool to_left[kMaxHeight];
+    int depth = 0;
+    NodeType* cand = NULL;
+    int cand_depth = 0;
+    NodeType* h = root_;
+    while (h != NULL){
+      if (Comp()(key, h->key)){
+        if (!IsRED(h->left) &&
+            h->left != NULL &&
+            !IsRED(h->left->left)){
+          h = MoveREDLeft(h);
+        }
+        path[depth] = h;
+        to_left[depth++] = true;
+        h = h->left;
+        continue;
+      }
+      // a rotation brings up a smaller key, so key may equal h->key only
+      // while h stays in place
+      NodeType* top = h;
+      if (IsRED(h->left)){
+        h = RotateRight(h);
+      }
+      if (h == top && h->right == NULL && !Comp()(h->key, key)){
+        DeleteNode(h);
+        return DeleteFixUp(path, to_left, depth);
+      }
+      if (!IsRED(h->right) &&
+          h->right != NULL &&
+          !IsRED(h->right->left)){
+        h = MoveREDRight(h);
+      }
+      cand = h;
+      cand_depth = depth;
+      path[depth] = h;
+      to_left[depth++] = false;
+      h = h->right;
     }
-    if (!IsRED(h->left) && !IsRED(h->left->left)){
-      h = MoveREDLeft(h);
+
+    if (cand != NULL && cand->right != NULL && !Comp()(cand->key, key)){
+      // the descent ended at the minimum of cand->right; put it at cand
+      NodeType* min = path[--depth];
+      min->left = cand->left;
+      min->right = cand->right;
+      min->color = cand->color;
+      path[cand_depth] = min;
+      DeleteNode(cand);
     }
-    Node<Key, Val>* new_left = DeleteMin(h->left);
-    if (new_left == NULL){
-      --num_;
-      delete h->left;
+    return DeleteFixUp(path, to_left, depth);
+  }
+
+  // Cut the link below path[depth-1] and apply FixUp bottom-up.
+  NodeType* DeleteFixUp(NodeType** path, const bool* to_left, int depth){
+    NodeType* child = NULL;
+    while (depth > 0){
+      NodeType* h = path[--depth];
+      NodeType*& link = to_left[depth] ? h->left : h->right;
+      if (link != child){
+        link = child;
+      }
+      Aug::Update(h);
+      child = FixUp(h);
     }
-    h->left = new_left;
-    return FixUp(h);
+    return child;
   }
 
-  Node<Key, Val>* GetMin(Node<Key, Val>* h){
+  // Unlink the node with the smallest key and return it without
+  // releasing it. The tree must not be empty.
+  NodeType* DetachMin(){
+    if (!IsRED(root_->left) && !IsRED(root_->right)){
+      root_->color = kRED;
+    }
+    NodeType* path[kMaxHeight];
+    bool to_left[kMaxHeight];
+    int depth = 0;
+    NodeType* h = root_;
     while (h->left != NULL){
+      if (!IsRED(h->left) && !IsRED(h->left->left)){
+        h = MoveREDLeft(h);
+      }
+      path[depth] = h;
+      to_left[depth++] = true;
       h = h->left;
     }
+    root_ = DeleteFixUp(path, to_left, depth);
+    if (root_ != NULL){
+      root_->color = kBLACK;
+    }
+    --num_;
     return h;
   }
 
-  Node<Key, Val>* DeleteInternal(Node<Key, Val>* h, Key key){
-    if (h == NULL) return NULL;
-    if (Comp()(key, h->key)){
-      if (!IsRED(h->left) && 
-          h->left != NULL &&
-          !IsRED(h->left->left)){
-        h = MoveREDLeft(h);
-      }
-      h->left = DeleteInternal(h->left, key);
+  static const NodeType* MinNode(const NodeType* h){
+    while (h->left != NULL) h = h->left;
+    return h;
+  }
+
+  static const NodeType* MaxNode(const NodeType* h){
+    while (h->right != NULL) h = h->right;
+    return h;
+  }
+
+  // The number of black nodes on a path from h to a leaf.
+  static int BlackHeight(const NodeType* h){
+    int height = 0;
+    for (; h != NULL; h = h->left){
+      if (h->color == kBLACK) ++height;
+    }
+    return height;
+  }
+
+  // Join the trees l and r, whose roots are black and whose black heights
+  // are lh and rh, with the pivot m lying between them. Return the new
+  // (black) root and set its black height to height.
+  NodeType* Join3(NodeType* l, int lh, NodeType* m, NodeType* r, int rh,
+                  int& height){
+    NodeType* root;
+    if (lh == rh){
+      m->left = l;
+      m->right = r;
+      m->color = kBLACK;
+      Aug::Update(m);
+      height = lh + 1;
+      return m;
+    } else if (lh > rh){
+      root = JoinRight(l, lh, m, r, rh);
+      height = lh;
     } else {
-      if (IsRED(h->left)){
-        h = RotateRight(h);
-      }
-      if ((key == h->key) && (h->right == NULL)){
-        return NULL;
-      }
-      if (!IsRED(h->right) && 
-          h->right != NULL && 
-          !IsRED(h->right->left)){
-        h = MoveREDRight(h);
+      root = JoinLeft(l, lh, m, r, rh);
+      height = rh;
+    }
+    if (IsRED(root)){
+      root->color = kBLACK;
+      ++height;
+    }
+    return root;
+  }
+
+  // Descend the right spine of h, which consists of black nodes, to the
+  // black height of r and hang r there below a red m.
+  NodeType* JoinRight(NodeType* h, int height, NodeType* m, NodeType* r,
+                      int r_height){
+    if (height == r_height){
+      m->left = h;
+      m->right = r;
+      m->color = kRED;
+      Aug::Update(m);
+      return m;
+    }
+    h->right = JoinRight(h->right, height - 1, m, r, r_height);
+    Aug::Update(h);
+    return FixUp(h);
+  }
+
+  // Descend the left spine of h to a black node at the black height of l
+  // and hang l there below a red m.
+  NodeType* JoinLeft(NodeType* l, int l_height, NodeType* m, NodeType* h,
+                     int height){
+    if (height == l_height && !IsRED(h)){
+      m->left = l;
+      m->right = h;
+      m->color = kRED;
+      Aug::Update(m);
+      return m;
+    }
+    int child_height = IsRED(h) ? height : height - 1;
+    h->left = JoinLeft(l, l_height, m, h->left, child_height);
+    Aug::Update(h);
+    return FixUp(h);
+  }
+
+  // Split the tree h, whose root is black and whose black height is
+  // height, into the keys less than key (lower) and the rest (upper).
+  void SplitInternal(NodeType* h, int height, const Key& key,
+                     NodeType*& lower, int& lower_height,
+                     NodeType*& upper, int& upper_height){
+    if (h == NULL){
+      lower = upper = NULL;
+      lower_height = upper_height = 0;
+      return;
+    }
+    NodeType* left = h->left;
+    NodeType* right = h->right;
+    int left_height = height - 1;
+    int right_height = height - 1;
+    if (IsRED(left)){
+      left->color = kBLACK;
+      ++left_height;
+    }
+    if (Comp()(h->key, key)){
+      NodeType* mid = NULL;
+      int mid_height = 0;
+      SplitInternal(right, right_height, key, mid, mid_height, upper, upper_height);
+      lower = Join3(left, left_height, h, mid, mid_height, lower_height);
+    } else {
+      NodeType* mid = NULL;
+      int mid_height = 0;
+      SplitInternal(left, left_height, key, lower, lower_height, mid, mid_height);
+      upper = Join3(mid, mid_height, h, right, right_height, upper_height);
+    }
+  }
+
+  // Insert the sorted batch [begin, end) into the tree h, whose root is
+  // black and whose black height is height. Return the new (black) root
+  // and set its black height to new_height. The batch is split at h, the
+  // halves go to the subtrees, and the results are joined back through h.
+  template <class ForwardIterator>
+  NodeType* UnionInternal(NodeType* h, int height,
+                          ForwardIterator begin, ForwardIterator end,
+                          int& new_height){
+    if (begin == end){
+      new_height = height;
+      return h;
+    }
+    if (h == NULL){
+      uint64_t num = std::distance(begin, end);
+      SortedSource<ForwardIterator> source(*this, begin);
+      new_height = BlackHeightFor(num);
+      return BuildInternal(num, new_height, source);
+    }
+    NodeType* left = h->left;
+    int left_height = height - 1;
+    int right_height = height - 1;
+    if (IsRED(left)){
+      left->color = kBLACK;
+      ++left_height;
+    }
+    ForwardIterator mid = std::lower_bound(begin, end, h->key,
+      [](const auto& entry, const Key& key){ return Comp()(entry.first, key); });
+    ForwardIterator next = mid;
+    if (mid != end && !Comp()(h->key, mid->first)){
+      h->val = mid->second;
+      ++next;
+    }
+    left = UnionInternal(left, left_height, begin, mid, left_height);
+    NodeType* right = UnionInternal(h->right, right_height, next, end,
+                                    right_height);
+    return Join3(left, left_height, h, right, right_height, new_height);
+  }
+
+  // Delete the sorted keys [begin, end) from the tree h as in
+  // UnionInternal. A deleted node is replaced by the largest node of its
+  // left subtree.
+  template <class ForwardIterator>
+  NodeType* DifferenceInternal(NodeType* h, int height,
+                               ForwardIterator begin, ForwardIterator end,
+                               int& new_height){
+    if (begin == end || h == NULL){
+      new_height = height;
+      return h;
+    }
+    NodeType* left = h->left;
+    int left_height = height - 1;
+    int right_height = height - 1;
+    if (IsRED(left)){
+      left->color = kBLACK;
+      ++left_height;
+    }
+    ForwardIterator mid = std::lower_bound(begin, end, h->key, Comp());
+    bool found = (mid != end && !Comp()(h->key, *mid));
+    ForwardIterator next = mid;
+    if (found){
+      ++next;
+    }
+    left = DifferenceInternal(left, left_height, begin, mid, left_height);
+    NodeType* right = DifferenceInternal(h->right, right_height, next, end,
+                                         right_height);
+    if (!found){
+      return Join3(left, left_height, h, right, right_height, new_height);
+    }
+    DeleteNode(h);
+    if (left == NULL){
+      new_height = right_height;
+      return right;
+    }
+    NodeType* rest = NULL;
+    int rest_height = 0;
+    NodeType* last = SplitLast(left, left_height, rest, rest_height);
+    return Join3(rest, rest_height, last, right, right_height, new_height);
+  }
+
+  // Unlink the node with the largest key from the tree h, whose root is
+  // black and whose black height is height, and return it. The remaining
+  // tree is set to rest, with black height rest_height.
+  NodeType* SplitLast(NodeType* h, int height,
+                      NodeType*& rest, int& rest_height){
+    NodeType* left = h->left;
+    int left_height = height - 1;
+    if (IsRED(left)){
+      left->color = kBLACK;
+      ++left_height;
+    }
+    if (h->right == NULL){
+      rest = left;
+      rest_height = left_height;
+      return h;
+    }
+    NodeType* right = NULL;
+    int right_height = 0;
+    NodeType* last = SplitLast(h->right, height - 1, right, right_height);
+    rest = Join3(left, left_height, h, right, right_height, rest_height);
+    return last;
+  }
+
+  // Preorder walk visiting one node per Next() without allocation.
+  class NodeWalker{
+  public:
+    explicit NodeWalker(const NodeType* root) : h_(root), depth_(0){
+    }
+
+    // Visit one node, or return false if every node has been visited.
+    bool Next(){
+      if (h_ == NULL){
+        if (depth_ == 0) return false;
+        h_ = stack_[--depth_];
       }
-      if (key == h->key){
-        Node<Key, Val>* min_node = GetMin(h->right);
-        h->key = min_node->key;
-        h->val = min_node->val;
-        h->right = DeleteMin(h->right);
-      } else {
-        h->right = DeleteInternal(h->right, key);
+      if (h_->right != NULL){
+        stack_[depth_++] = h_->right;
       }
+      h_ = h_->left;
+      return true;
     }
-    return FixUp(h);
+
+  private:
+    const NodeType* h_;
+    const NodeType* stack_[kMaxHeight];
+    int depth_;
+  };
+
+  // Return the number of nodes of lower, where lower and upper together
+  // hold num_ nodes.
+  uint64_t LowerNum(const NodeType* lower, const NodeType*, std::true_type) const{
+    return Aug::Size(lower);
   }
 
-  int DepthSumInternal(const Node<Key, Val>* h, int depth) const{
+  // Without subtree sizes both trees are walked in lockstep until the
+  // smaller one is exhausted.
+  uint64_t LowerNum(const NodeType* lower, const NodeType* upper, std::false_type) const{
+    NodeWalker lower_walker(lower);
+    NodeWalker upper_walker(upper);
+    uint64_t lower_num = 0;
+    uint64_t upper_num = 0;
+    for (;;){
+      if (!lower_walker.Next()) return lower_num;
+      ++lower_num;
+      if (!upper_walker.Next()) return num_ - upper_num;
+      ++upper_num;
+    }
+  }
+
+  int DepthSumInternal(const NodeType* h, int depth) const{
     if (h == NULL) return 0;
     return depth 
       + DepthSumInternal(h->left, depth+1)
       + DepthSumInternal(h->right, depth+1);
   }
 
+  // Return the black height of h, or -1 if the subtree is broken.
+  int IsValidInternal(const NodeType* h, const Key* lo, const Key* hi,
+                      uint64_t& num) const{
+    if (h == NULL) return 0;
+    ++num;
+    if (lo != NULL && !Comp()(*lo, h->key)) return -1;
+    if (hi != NULL && !Comp()(h->key, *hi)) return -1;
+    if (IsRED(h->right)) return -1;
+    if (IsRED(h) && IsRED(h->left)) return -1;
+    int left_height = IsValidInternal(h->left, lo, &h->key, num);
+    int right_height = IsValidInternal(h->right, &h->key, hi, num);
+    if (left_height < 0 || left_height != right_height) return -1;
+    return left_height + (IsRED(h) ? 0 : 1);
+  }
+
   static int MyMax(int x, int y) {
     return (x > y) ? x : y;
   }
 
-  int DepthMaxInternal(const Node<Key, Val>* h, int depth) const{
+  int DepthMaxInternal(const NodeType* h, int depth) const{
     if (h == NULL) return depth;
     return MyMax(DepthMaxInternal(h->left, depth+1),
                  DepthMaxInternal(h->right, depth+1));
   }
 
-  Node<Key, Val>* root_;
+  NodeType* root_;
   uint64_t num_;
+  Alloc<NodeType> alloc_;
 };
 
 } // namespace llrbpp
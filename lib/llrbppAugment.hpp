@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_AUGMENT_HPP_
+#define LLRBPP_AUGMENT_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include <limits>
+
+namespace llrbpp{
+
+/**
+ * Augmentation policies of LLRBPP.
+ * Node<K, V, Aug> derives from Aug::Data, and LLRBPP calls
+ * Aug::Update(node) whenever a child of node or node itself changes,
+ * children first. kEnabled is false iff Update does nothing, and
+ * kHasSize is true iff the policy provides Size(node).
+ */
+
+/**
+ * No augmentation. Data is empty and costs no space in a node.
+ */
+struct NoAugment{
+  static const bool kEnabled = false;
+  static const bool kHasSize = false;
+
+  struct Data{
+  };
+
+  template <class NodeType>
+  static void Update(NodeType*){
+  }
+};
+
+/**
+ * Subtree sizes, enabling LLRBPP::Rank, Select and CountInRange.
+ */
+struct SizeAugment{
+  static const bool kEnabled = true;
+  static const bool kHasSize = true;
+
+  struct Data{
+    uint64_t size;
+  };
+
+  template <class NodeType>
+  static uint64_t Size(const NodeType* h){
+    return (h == NULL) ? 0 : h->size;
+  }
+
+  template <class NodeType>
+  static void Update(NodeType* h){
+    h->size = Size(h->left) + Size(h->right) + 1;
+  }
+};
+
+/**
+ * Subtree sizes and an aggregate of a monoid M, enabling
+ * LLRBPP::Aggregate and AggregateByPosition in addition to the
+ * SizeAugment operations. M provides
+ *   typedef ... Value;
+ *   static Value Identity();
+ *   static Value Combine(const Value& x, const Value& y); // associative
+ *   template <class K, class V> static Value Lift(const K& key, const V& val);
+ * Combine is applied in key order, so M needs not be commutative.
+ */
+template <class M>
+struct MonoidAugment{
+  static const bool kEnabled = true;
+  static const bool kHasSize = true;
+  typedef M Monoid;
+  typedef typename M::Value Value;
+
+  struct Data{
+    uint64_t size;
+    Value agg;
+  };
+
+  template <class NodeType>
+  static uint64_t Size(const NodeType* h){
+    return (h == NULL) ? 0 : h->size;
+  }
+
+  template <class NodeType>
+  static Value Agg(const NodeType* h){
+    return (h == NULL) ? M::Identity() : h->agg;
+  }
+
+  template <class NodeType>
+  static Value Lift(const NodeType* h){
+    return M::Lift(h->key, h->val);
+  }
+
+  template <class NodeType>
+  static void Update(NodeType* h){
+    h->size = Size(h->left) + Size(h->right) + 1;
+    h->agg = M::Combine(M::Combine(Agg(h->left), Lift(h)), Agg(h->right));
+  }
+};
+
+/**
+ * Sum of values
+ */
+template <class T>
+struct SumMonoid{
+  typedef T Value;
+  static T Identity(){
+    return T();
+  }
+  static T Combine(const T& x, const T& y){
+    return x + y;
+  }
+  template <class K, class V>
+  static T Lift(const K&, const V& val){
+    return static_cast<T>(val);
+  }
+};
+
+/**
+ * Minimum of values
+ */
+template <class T>
+struct MinMonoid{
+  typedef T Value;
+  static T Identity(){
+    return std::numeric_limits<T>::max();
+  }
+  static T Combine(const T& x, const T& y){
+    return (y < x) ? y : x;
+  }
+  template <class K, class V>
+  static T Lift(const K&, const V& val){
+    return static_cast<T>(val);
+  }
+};
+
+/**
+ * Maximum of values
+ */
+template <class T>
+struct MaxMonoid{
+  typedef T Value;
+  static T Identity(){
+    return std::numeric_limits<T>::lowest();
+  }
+  static T Combine(const T& x, const T& y){
+    return (x < y) ? y : x;
+  }
+  template <class K, class V>
+  static T Lift(const K&, const V& val){
+    return static_cast<T>(val);
+  }
+};
+
+/**
+ * Greatest common divisor of non-negative integer values
+ */
+template <class T>
+struct GcdMonoid{
+  typedef T Value;
+  static T Identity(){
+    return T();
+  }
+  static T Combine(T x, T y){
+    while (y != 0){
+      T r = x % y;
+      x = y;
+      y = r;
+    }
+    return x;
+  }
+  template <class K, class V>
+  static T Lift(const K&, const V& val){
+    return static_cast<T>(val);
+  }
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_AUGMENT_HPP_
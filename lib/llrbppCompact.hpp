@@ -0,0 +1,371 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_COMPACT_HPP_
+#define LLRBPP_COMPACT_HPP_
+
+#include <stdint.h>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "llrbppCompare.hpp"
+#include "llrbppNode.hpp"
+#include "llrbppCompactNode.hpp"
+
+namespace llrbpp{
+
+/**
+ * Left-Leaning Red-Black Tree storing its nodes in one vector.
+ * Same interface as LLRBPP, but children are 32-bit indices with the
+ * color packed into one of them, so LLRBPP<uint32_t, uint32_t> takes
+ * 16 bytes per entry instead of 32. At most 2^31-1 entries.
+ * Deleted slots are kept in a free list threaded through right_ind, and
+ * their key and value are reset to Key() and Val() when freed.
+ */
+template <class Key, class Val, class Comp = std::less<Key> >
+class CompactLLRBPP{
+  typedef CompactNode<Key, Val> NodeType;
+  typedef ThreeWay<Comp, Key, Key> Cmp;
+
+public:
+  CompactLLRBPP() : root_ind_(kCompactNULL), free_ind_(kCompactNULL), num_(0){
+  }
+
+  ~CompactLLRBPP(){
+  }
+
+  void Insert(const Key& key, const Val& val){
+    root_ind_ = InsertInternal(root_ind_, key, val, kCompactNULL);
+    nodes_[root_ind_].SetColor(kBLACK);
+  }
+
+  void Delete(const Key& key){
+    if (root_ind_ == kCompactNULL) return;
+    NodeType& root = nodes_[root_ind_];
+    if (!IsRED(root.Left()) && !IsRED(root.Right())){
+      root.SetColor(kRED);
+    }
+    uint32_t min_ind = kCompactNULL;
+    root_ind_ = DeleteInternal(root_ind_, key, kCompactNULL, min_ind);
+    if (root_ind_ != kCompactNULL){
+      nodes_[root_ind_].SetColor(kBLACK);
+    }
+  }
+
+  void Clear(){
+    nodes_.clear();
+    root_ind_ = kCompactNULL;
+    free_ind_ = kCompactNULL;
+    num_ = 0;
+  }
+
+  void Reserve(size_t num){
+    nodes_.reserve(num);
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  // Without a cheap three-way comparison the search makes one Comp call
+  // per level and tests the last candidate for equality at the end.
+  std::pair<bool, Val> Find(const Key& key) const{
+    if (Cmp::kEnabled){
+      for (uint32_t ind = root_ind_; ind != kCompactNULL; ){
+        const NodeType& node = nodes_[ind];
+        int cmp = Cmp::Compare(key, node.key);
+        if (cmp == 0){
+          return std::make_pair(true, node.val);
+        }
+        ind = (cmp < 0) ? node.Left() : node.Right();
+      }
+      return std::make_pair(false, Val());
+    }
+    uint32_t cand = kCompactNULL;
+    for (uint32_t ind = root_ind_; ind != kCompactNULL; ){
+      const NodeType& node = nodes_[ind];
+      if (Comp()(node.key, key)){
+        ind = node.Right();
+      } else {
+        cand = ind;
+        ind = node.Left();
+      }
+    }
+    if (cand == kCompactNULL || Comp()(key, nodes_[cand].key)){
+      return std::make_pair(false, Val());
+    }
+    return std::make_pair(true, nodes_[cand].val);
+  }
+
+  int DepthSum() const{
+    return DepthSumInternal(root_ind_, 0);
+  }
+
+  int DepthMax() const{
+    return DepthMaxInternal(root_ind_, 0);
+  }
+
+  uint64_t Num() const {
+    return num_;
+  }
+
+  // Return true iff the tree is a valid left-leaning red-black tree.
+  bool IsValid() const{
+    if (IsRED(root_ind_)) return false;
+    uint64_t num = 0;
+    return IsValidInternal(root_ind_, NULL, NULL, num) >= 0 && num == num_;
+  }
+
+private:
+  uint32_t NewNode(const Key& key, const Val& val){
+    uint32_t ind = free_ind_;
+    if (ind != kCompactNULL){
+      free_ind_ = nodes_[ind].Right();
+      nodes_[ind] = NodeType(key, val);
+    } else {
+      if (nodes_.size() >= kCompactNULL){
+        throw std::length_error("CompactLLRBPP::NewNode too many nodes");
+      }
+      ind = static_cast<uint32_t>(nodes_.size());
+      nodes_.push_back(NodeType(key, val));
+    }
+    ++num_;
+    return ind;
+  }
+
+  void DeleteNode(uint32_t ind){
+    // release the payload now rather than when the slot is reused
+    nodes_[ind].key = Key();
+    nodes_[ind].val = Val();
+    nodes_[ind].SetRight(free_ind_);
+    free_ind_ = ind;
+    --num_;
+  }
+
+  bool IsRED(uint32_t ind) const {
+    // IsRED is true iff ind is not NULL and nodes_[ind] is RED
+    if (ind == kCompactNULL) return false;
+    return nodes_[ind].Color() == kRED;
+  }
+
+  void FlipColor(uint32_t ind){
+    NodeType& x = nodes_[ind];
+    x.SetColor(!x.Color());
+    if (x.Left() != kCompactNULL){
+      NodeType& left = nodes_[x.Left()];
+      left.SetColor(!left.Color());
+    }
+    if (x.Right() != kCompactNULL){
+      NodeType& right = nodes_[x.Right()];
+      right.SetColor(!right.Color());
+    }
+  }
+
+  uint32_t RotateLeft(uint32_t h_ind){
+    NodeType& h = nodes_[h_ind];
+    uint32_t x_ind = h.Right();
+    NodeType& x = nodes_[x_ind];
+    h.SetRight(x.Left());
+    x.SetLeft(h_ind);
+    x.SetColor(h.Color());
+    h.SetColor(kRED);
+    return x_ind;
+  }
+
+  uint32_t RotateRight(uint32_t h_ind){
+    NodeType& h = nodes_[h_ind];
+    uint32_t x_ind = h.Left();
+    NodeType& x = nodes_[x_ind];
+    h.SetLeft(x.Right());
+    x.SetRight(h_ind);
+    x.SetColor(h.Color());
+    h.SetColor(kRED);
+    return x_ind;
+  }
+
+  // cand_ind is the last node left to the right, the only one on the
+  // path that can hold key; it is tested for equality at the bottom so
+  // that each level makes one Comp call.
+  uint32_t InsertInternal(uint32_t h_ind, const Key& key, const Val& val,
+                          uint32_t cand_ind){
+    if (h_ind == kCompactNULL){
+      if (cand_ind != kCompactNULL && !Comp()(nodes_[cand_ind].key, key)){
+        nodes_[cand_ind].val = val;
+        return kCompactNULL;
+      }
+      return NewNode(key, val);
+    }
+
+    // nodes_ may be reallocated by NewNode, so no reference is kept
+    // across the recursive calls.
+    if (Comp()(key, nodes_[h_ind].key)){
+      uint32_t ret = InsertInternal(nodes_[h_ind].Left(), key, val, cand_ind);
+      nodes_[h_ind].SetLeft(ret);
+    } else {
+      uint32_t ret = InsertInternal(nodes_[h_ind].Right(), key, val, h_ind);
+      nodes_[h_ind].SetRight(ret);
+    }
+
+    if (IsRED(nodes_[h_ind].Right()) && !IsRED(nodes_[h_ind].Left())){
+      h_ind = RotateLeft(h_ind);
+    }
+
+    uint32_t left_ind = nodes_[h_ind].Left();
+    if (IsRED(left_ind) && IsRED(nodes_[left_ind].Left())){
+      h_ind = RotateRight(h_ind);
+    }
+
+    if (IsRED(nodes_[h_ind].Left()) && IsRED(nodes_[h_ind].Right())){
+      FlipColor(h_ind);
+    }
+
+    return h_ind;
+  }
+
+  uint32_t MoveREDLeft(uint32_t h_ind){
+    FlipColor(h_ind);
+    uint32_t right_ind = nodes_[h_ind].Right();
+    if (right_ind != kCompactNULL && IsRED(nodes_[right_ind].Left())){
+      nodes_[h_ind].SetRight(RotateRight(right_ind));
+      h_ind = RotateLeft(h_ind);
+      FlipColor(h_ind);
+    }
+    return h_ind;
+  }
+
+  uint32_t MoveREDRight(uint32_t h_ind){
+    FlipColor(h_ind);
+    uint32_t left_ind = nodes_[h_ind].Left();
+    if (left_ind != kCompactNULL && IsRED(nodes_[left_ind].Left())){
+      h_ind = RotateRight(h_ind);
+      FlipColor(h_ind);
+    }
+    return h_ind;
+  }
+
+  uint32_t FixUp(uint32_t h_ind){
+    if (IsRED(nodes_[h_ind].Right())){
+      h_ind = RotateLeft(h_ind);
+    }
+    uint32_t left_ind = nodes_[h_ind].Left();
+    if (IsRED(left_ind) && IsRED(nodes_[left_ind].Left())){
+      h_ind = RotateRight(h_ind);
+    }
+    if (IsRED(nodes_[h_ind].Left()) && IsRED(nodes_[h_ind].Right())){
+      FlipColor(h_ind);
+    }
+    return h_ind;
+  }
+
+  // As InsertInternal, each level makes one Comp call: cand_ind is the
+  // last node left to the right, and if it holds key, every later step
+  // goes left, down to the minimum of its right subtree. That minimum is
+  // unlinked into min_ind and relinked in place of cand_ind.
+  uint32_t DeleteInternal(uint32_t h_ind, const Key& key, uint32_t cand_ind,
+                          uint32_t& min_ind){
+    if (h_ind == kCompactNULL) return kCompactNULL;
+    if (Comp()(key, nodes_[h_ind].key)){
+      uint32_t left_ind = nodes_[h_ind].Left();
+      if (left_ind == kCompactNULL){
+        if (cand_ind != kCompactNULL && !Comp()(nodes_[cand_ind].key, key)){
+          min_ind = h_ind;
+          return kCompactNULL;
+        }
+        return h_ind;
+      }
+      if (!IsRED(left_ind) && !IsRED(nodes_[left_ind].Left())){
+        h_ind = MoveREDLeft(h_ind);
+      }
+      uint32_t ret = DeleteInternal(nodes_[h_ind].Left(), key, cand_ind, min_ind);
+      nodes_[h_ind].SetLeft(ret);
+      return FixUp(h_ind);
+    }
+
+    // a rotation brings up a smaller key, so key may equal the key of h
+    // only while h stays in place
+    uint32_t top_ind = h_ind;
+    if (IsRED(nodes_[h_ind].Left())){
+      h_ind = RotateRight(h_ind);
+    }
+    if (h_ind == top_ind && nodes_[h_ind].Right() == kCompactNULL &&
+        !Comp()(nodes_[h_ind].key, key)){
+      DeleteNode(h_ind);
+      return kCompactNULL;
+    }
+    uint32_t right_ind = nodes_[h_ind].Right();
+    if (!IsRED(right_ind) &&
+        right_ind != kCompactNULL &&
+        !IsRED(nodes_[right_ind].Left())){
+      h_ind = MoveREDRight(h_ind);
+    }
+    uint32_t ret = DeleteInternal(nodes_[h_ind].Right(), key, h_ind, min_ind);
+    nodes_[h_ind].SetRight(ret);
+    if (min_ind != kCompactNULL){
+      // the descent ended at the minimum of the right subtree; put it at h
+      NodeType& min = nodes_[min_ind];
+      min.SetLeft(nodes_[h_ind].Left());
+      min.SetRight(nodes_[h_ind].Right());
+      min.SetColor(nodes_[h_ind].Color());
+      DeleteNode(h_ind);
+      h_ind = min_ind;
+      min_ind = kCompactNULL;
+    }
+    return FixUp(h_ind);
+  }
+
+  int DepthSumInternal(uint32_t ind, int depth) const{
+    if (ind == kCompactNULL) return 0;
+    return depth
+      + DepthSumInternal(nodes_[ind].Left(), depth+1)
+      + DepthSumInternal(nodes_[ind].Right(), depth+1);
+  }
+
+  // Return the black height of the subtree, or -1 if it is broken.
+  int IsValidInternal(uint32_t ind, const Key* lo, const Key* hi,
+                      uint64_t& num) const{
+    if (ind == kCompactNULL) return 0;
+    ++num;
+    const NodeType& h = nodes_[ind];
+    if (lo != NULL && !Comp()(*lo, h.key)) return -1;
+    if (hi != NULL && !Comp()(h.key, *hi)) return -1;
+    if (IsRED(h.Right())) return -1;
+    if (IsRED(ind) && IsRED(h.Left())) return -1;
+    int left_height = IsValidInternal(h.Left(), lo, &h.key, num);
+    int right_height = IsValidInternal(h.Right(), &h.key, hi, num);
+    if (left_height < 0 || left_height != right_height) return -1;
+    return left_height + (IsRED(ind) ? 0 : 1);
+  }
+
+  static int MyMax(int x, int y) {
+    return (x > y) ? x : y;
+  }
+
+  int DepthMaxInternal(uint32_t ind, int depth) const{
+    if (ind == kCompactNULL) return depth;
+    return MyMax(DepthMaxInternal(nodes_[ind].Left(), depth+1),
+                 DepthMaxInternal(nodes_[ind].Right(), depth+1));
+  }
+
+  std::vector<NodeType> nodes_;
+  uint32_t root_ind_;
+  uint32_t free_ind_;
+  uint64_t num_;
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_COMPACT_HPP_
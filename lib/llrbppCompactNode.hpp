@@ -0,0 +1,73 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_COMPACT_NODE_HPP_
+#define LLRBPP_COMPACT_NODE_HPP_
+
+#include <stdint.h>
+
+namespace llrbpp{
+
+const static uint32_t kCompactNULL = 0x7FFFFFFFU;
+const static uint32_t kCompactColorBit = 0x80000000U;
+
+/**
+ * Node of CompactLLRBPP.
+ * Children are 31-bit indices into the node array and the color is
+ * stored in the most significant bit of left_ind.
+ */
+template <class K, class V>
+struct CompactNode{
+  CompactNode(const K& key, const V& val) : 
+    key(key), val(val), left_ind(kCompactNULL | kCompactColorBit), 
+    right_ind(kCompactNULL) {}
+
+  uint32_t Left() const{
+    return left_ind & ~kCompactColorBit;
+  }
+
+  uint32_t Right() const{
+    return right_ind;
+  }
+
+  void SetLeft(uint32_t ind){
+    left_ind = (left_ind & kCompactColorBit) | ind;
+  }
+
+  void SetRight(uint32_t ind){
+    right_ind = ind;
+  }
+
+  bool Color() const{
+    return (left_ind & kCompactColorBit) != 0;
+  }
+
+  void SetColor(bool color){
+    left_ind = color ? (left_ind | kCompactColorBit) : (left_ind & ~kCompactColorBit);
+  }
+
+  K key;
+  V val;
+  uint32_t left_ind;
+  uint32_t right_ind;
+};
+
+}
+
+#endif // LLRBPP_COMPACT_NODE_HPP_
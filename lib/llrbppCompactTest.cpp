@@ -0,0 +1,168 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+  * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+#include "llrbppCompact.hpp"
+
+using namespace std;
+
+TEST(CompactLLRBPP, trivial){
+  llrbpp::CompactLLRBPP<string, int> fid;
+  EXPECT_EQ(0, fid.Num());
+  fid.Insert("eee", 5);
+  fid.Insert("aaa", 3);
+  fid.Insert("bbb", 4);
+  fid.Insert("ccc", 2);
+
+  EXPECT_EQ(4, fid.Num());
+  EXPECT_EQ(make_pair(true, 5), fid.Find("eee"));
+  EXPECT_EQ(make_pair(false, int()), fid.Find("ddd"));
+
+  fid.Delete("eee");
+  EXPECT_EQ(make_pair(false, int()), fid.Find("eee"));
+  EXPECT_EQ(3, fid.Num());
+
+  fid.Clear();
+  EXPECT_EQ(0, fid.Num());
+  EXPECT_EQ(make_pair(false, int()), fid.Find("eee"));
+}
+
+TEST(CompactLLRBPP, size){
+  EXPECT_EQ(16, sizeof(llrbpp::CompactNode<uint32_t, uint32_t>));
+}
+
+TEST(CompactLLRBPP, random){
+  llrbpp::CompactLLRBPP<uint32_t, uint32_t> fid;
+  map<uint32_t, uint32_t> m;
+  const uint32_t key_range = 5000;
+  for (int i = 0; i < 200000; ++i){
+    uint32_t key = rand() % key_range;
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      uint32_t val = rand();
+      fid.Insert(key, val);
+      m[key] = val;
+    }
+  }
+  ASSERT_EQ(m.size(), fid.Num());
+  ASSERT_TRUE(fid.IsValid());
+  for (uint32_t key = 0; key < key_range; ++key){
+    map<uint32_t, uint32_t>::const_iterator it = m.find(key);
+    if (it == m.end()){
+      EXPECT_EQ(make_pair(false, uint32_t()), fid.Find(key));
+    } else {
+      EXPECT_EQ(make_pair(true, it->second), fid.Find(key));
+    }
+  }
+}
+
+TEST(CompactLLRBPP, stringcompare){
+  llrbpp::CompactLLRBPP<string, int, llrbpp::StringCompare> fid;
+  map<string, int> m;
+  for (int i = 0; i < 3000; ++i){
+    string key = to_string(rand() % 1000);
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (map<string, int>::const_iterator it = m.begin(); it != m.end(); ++it){
+    EXPECT_EQ(make_pair(true, it->second), fid.Find(it->first));
+  }
+}
+
+TEST(CompactLLRBPP, deletereleases){
+  llrbpp::CompactLLRBPP<int, shared_ptr<int> > fid;
+  vector<shared_ptr<int> > vals;
+  for (int i = 0; i < 1000; ++i){
+    vals.push_back(make_shared<int>(i));
+    fid.Insert(i, vals.back());
+  }
+  for (int i = 0; i < 1000; i += 2){
+    fid.Delete(i);
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(500, fid.Num());
+  for (int i = 0; i < 1000; ++i){
+    if (i % 2 == 0){
+      EXPECT_EQ(1, vals[i].use_count());
+      EXPECT_FALSE(fid.Find(i).first);
+    } else {
+      EXPECT_EQ(2, vals[i].use_count());
+      EXPECT_EQ(vals[i], fid.Find(i).second);
+    }
+  }
+}
+
+// orders strings and counts the calls, without a three-way Compare
+struct CountingLess{
+  bool operator()(const string& a, const string& b) const{
+    ++count;
+    return a < b;
+  }
+  static int count;
+};
+int CountingLess::count = 0;
+
+TEST(CompactLLRBPP, comparecount){
+  llrbpp::CompactLLRBPP<string, int, CountingLess> fid;
+  for (int i = 0; i < 4096; ++i){
+    fid.Insert(to_string(i), i);
+  }
+  int depth = fid.DepthMax();
+  for (int i = 0; i < 4096; i += 7){
+    CountingLess::count = 0;
+    EXPECT_EQ(make_pair(true, i), fid.Find(to_string(i)));
+    EXPECT_LE(CountingLess::count, depth + 1);
+    CountingLess::count = 0;
+    fid.Insert(to_string(i), -i);
+    EXPECT_LE(CountingLess::count, depth + 1);
+    EXPECT_EQ(make_pair(true, -i), fid.Find(to_string(i)));
+  }
+  EXPECT_EQ(4096, fid.Num());
+  EXPECT_EQ(make_pair(false, int()), fid.Find("x"));
+  ASSERT_TRUE(fid.IsValid());
+
+  for (int i = 0; i < 4096; i += 3){
+    fid.Delete(to_string(i));
+    // a key beyond the maximum costs one Comp call per level
+    depth = fid.DepthMax();
+    CountingLess::count = 0;
+    fid.Delete("x");
+    EXPECT_LE(CountingLess::count, depth + 2);
+  }
+  ASSERT_TRUE(fid.IsValid());
+  EXPECT_EQ(4096 - 1366, fid.Num());
+  for (int i = 0; i < 4096; ++i){
+    int val = (i % 7 == 0) ? -i : i;
+    EXPECT_EQ(make_pair(i % 3 != 0, (i % 3 != 0) ? val : int()),
+              fid.Find(to_string(i))) << " key=" << i;
+  }
+}
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_COMPARE_HPP_
+#define LLRBPP_COMPARE_HPP_
+
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace llrbpp{
+
+/**
+ * Key comparison of the search paths.
+ * The trees need only the strict weak order Comp()(a, b). A comparator
+ * may also provide
+ *   int Compare(const A& a, const B& b) const;
+ * returning a negative value, zero or a positive value as a is less
+ * than, equivalent to or greater than b, so that a search decides each
+ * level, including equality, by one call.
+ */
+template <class Comp, class A, class B, class = void>
+struct HasCompare : std::false_type{
+};
+
+template <class Comp, class A, class B>
+struct HasCompare<Comp, A, B,
+                  decltype(void(std::declval<const Comp&>().Compare(
+                                  std::declval<const A&>(),
+                                  std::declval<const B&>())))>
+  : std::true_type{
+};
+
+/**
+ * Three-way comparison of an A with a B under Comp.
+ * kEnabled is true if it costs about one Comp call: Comp provides
+ * Compare, or both types are arithmetic so that the two Comp calls fold
+ * into one instruction. Otherwise Compare calls Comp once for a < b and
+ * twice for the other outcomes, and searches rather defer the equality
+ * test to the end of the descent.
+ */
+template <class Comp, class A, class B>
+struct ThreeWay{
+  static const bool kEnabled = HasCompare<Comp, A, B>::value ||
+    (std::is_arithmetic<A>::value && std::is_arithmetic<B>::value);
+
+  static int Compare(const A& a, const B& b){
+    return CompareInternal(a, b, HasCompare<Comp, A, B>());
+  }
+
+private:
+  static int CompareInternal(const A& a, const B& b, std::true_type){
+    return Comp().Compare(a, b);
+  }
+
+  static int CompareInternal(const A& a, const B& b, std::false_type){
+    return CompareByLess(a, b, std::integral_constant<bool, kEnabled>());
+  }
+
+  // Both calls are evaluated so that arithmetic keys compile to flag
+  // arithmetic without branches.
+  static int CompareByLess(const A& a, const B& b, std::true_type){
+    return static_cast<int>(Comp()(b, a)) - static_cast<int>(Comp()(a, b));
+  }
+
+  static int CompareByLess(const A& a, const B& b, std::false_type){
+    if (Comp()(a, b)) return -1;
+    return Comp()(b, a) ? 1 : 0;
+  }
+};
+
+/**
+ * Comparator for std::string keys comparing two keys once per level.
+ * It is transparent, so std::string_view and const char* probes are
+ * compared without building a std::string.
+ */
+struct StringCompare{
+  typedef void is_transparent;
+
+  bool operator()(std::string_view a, std::string_view b) const{
+    return a < b;
+  }
+
+  int Compare(std::string_view a, std::string_view b) const{
+    return a.compare(b);
+  }
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_COMPARE_HPP_
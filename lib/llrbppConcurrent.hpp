@@ -0,0 +1,262 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_CONCURRENT_HPP_
+#define LLRBPP_CONCURRENT_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "llrbppEpoch.hpp"
+#include "llrbppNode.hpp"
+#include "llrbppPathCopy.hpp"
+#include "llrbppPool.hpp"
+
+namespace llrbpp{
+
+template <class K, class V>
+struct ConcurrentNode{
+  ConcurrentNode(const K& key, const V& val, uint64_t version) :
+    key(key), val(val), left(NULL), right(NULL), color(kRED),
+    version(version) {}
+
+  K key;
+  V val;
+  ConcurrentNode* left;
+  ConcurrentNode* right;
+  bool color;
+  uint64_t version; // the update that created this node
+};
+
+/**
+ * Left-leaning red-black tree with lock-free readers and one writer.
+ * Published nodes are never modified. An update copies every node it
+ * changes (path copying), builds the new version from the copies and
+ * the untouched subtrees, and publishes it by swapping the root, so a
+ * reader sees the whole tree as of one update. The replaced nodes are
+ * freed by epoch-based reclamation once no reader can hold them.
+ * Updates are serialized by a mutex; they may come from any thread.
+ * Only the writer allocates and frees nodes, so Alloc need not be
+ * thread-safe.
+ */
+template <class Key, class Val, class Comp = std::less<Key>,
+          template <class> class Alloc = NodePool>
+class ConcurrentLLRBPP :
+    private PathCopyLLRB<ConcurrentLLRBPP<Key, Val, Comp, Alloc>,
+                         ConcurrentNode<Key, Val>, Key, Val, Comp>{
+  typedef ConcurrentNode<Key, Val> NodeType;
+  typedef PathCopyLLRB<ConcurrentLLRBPP, NodeType, Key, Val, Comp> Base;
+  friend Base;
+  using Base::IsRED;
+  using Base::FindNode;
+
+  // The height of a LLRB tree is at most 2 log_2 (num + 1)
+  static const int kMaxHeight = 128;
+
+  // Retired nodes are reclaimed in batches of at least this many.
+  static const size_t kReclaimBatch = 1024;
+
+public:
+  ConcurrentLLRBPP() : root_(NULL), num_(0), version_(0){
+  }
+
+  // No reader or writer may be running.
+  ~ConcurrentLLRBPP(){
+    DestroyInternal(root_.load());
+    for (size_t i = 0; i < retired_.size(); ++i){
+      FreeNode(retired_[i].second);
+    }
+  }
+
+  void Insert(const Key& key, const Val& val){
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    ++version_;
+    bool inserted = false;
+    NodeType* root = this->InsertInternal(
+      root_.load(std::memory_order_relaxed), key, val, NULL, inserted);
+    root->color = kBLACK;
+    if (inserted){
+      num_.fetch_add(1, std::memory_order_relaxed);
+    }
+    Publish(root);
+  }
+
+  void Delete(const Key& key){
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    NodeType* root = root_.load(std::memory_order_relaxed);
+    if (root == NULL) return;
+    ++version_;
+    if (!IsRED(root->left) && !IsRED(root->right)){
+      root = Own(root);
+      root->color = kRED;
+    }
+    bool deleted = false;
+    root = this->DeleteInternal(root, key, NULL, deleted);
+    if (root != NULL){
+      root->color = kBLACK;
+    }
+    if (deleted){
+      num_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // publish even if key was absent, since the path was copied
+    Publish(root);
+  }
+
+  void Clear(){
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    ++version_;
+    RetireInternal(root_.load(std::memory_order_relaxed));
+    num_.store(0, std::memory_order_relaxed);
+    Publish(NULL);
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  std::pair<bool, Val> Find(const Key& key) const{
+    EpochManager::Guard guard(epochs_);
+    const NodeType* node = FindNode(root_.load(), key);
+    if (node == NULL) return std::make_pair(false, Val());
+    return std::make_pair(true, node->val);
+  }
+
+  bool Contains(const Key& key) const{
+    EpochManager::Guard guard(epochs_);
+    return FindNode(root_.load(), key) != NULL;
+  }
+
+  /**
+   * Call fn(key, val) for every key in [lo, hi) in ascending order.
+   * All calls see the same version; updates made meanwhile are not
+   * visible, and the nodes of that version stay allocated until fn
+   * returns for the last time.
+   */
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    EpochManager::Guard guard(epochs_);
+    Base::ForEachInRangeInternal(root_.load(), lo, hi, fn);
+  }
+
+  // The number of keys as of the last completed update.
+  uint64_t Num() const {
+    return num_.load(std::memory_order_relaxed);
+  }
+
+  // Return true iff the current version is a valid LLRB tree.
+  bool IsValid() const{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    uint64_t num = 0;
+    const NodeType* root = root_.load(std::memory_order_relaxed);
+    return !IsRED(root) && Base::IsValidInternal(root, NULL, NULL, num) >= 0 &&
+      num == num_.load(std::memory_order_relaxed);
+  }
+
+private:
+  NodeType* NewNode(const Key& key, const Val& val){
+    return new(alloc_.Allocate()) NodeType(key, val, version_);
+  }
+
+  void FreeNode(NodeType* node){
+    node->~NodeType();
+    alloc_.Deallocate(node);
+  }
+
+  // Return node itself if this update created it, or a copy of it to
+  // modify; the original is retired.
+  NodeType* Own(NodeType* node){
+    if (node->version == version_) return node;
+    NodeType* copy = new(alloc_.Allocate()) NodeType(*node);
+    copy->version = version_;
+    Retire(node);
+    return copy;
+  }
+
+  // Drop a node this update no longer links.
+  void Unlink(NodeType* node){
+    if (node->version == version_){
+      FreeNode(node);
+    } else {
+      Retire(node);
+    }
+  }
+
+  void Retire(NodeType* node){
+    retired_.push_back(std::make_pair(epochs_.Current(), node));
+  }
+
+  void RetireInternal(NodeType* node){
+    ForEachNode(node, [this](NodeType* h){ Retire(h); });
+  }
+
+  // Make root the current version, then free the retired nodes no
+  // reader can reach anymore.
+  void Publish(NodeType* root){
+    root_.store(root);
+    epochs_.Advance();
+    if (retired_.size() < kReclaimBatch) return;
+    uint64_t min_epoch = epochs_.MinActive();
+    size_t freed = 0;
+    while (freed < retired_.size() && retired_[freed].first < min_epoch){
+      FreeNode(retired_[freed++].second);
+    }
+    retired_.erase(retired_.begin(), retired_.begin() + freed);
+  }
+
+  void DestroyInternal(NodeType* node){
+    ForEachNode(node, [this](NodeType* h){ FreeNode(h); });
+  }
+
+  // Call fn(node) for every node of h without recursion; fn may free
+  // node, since its links are read before. The stack holds pending right
+  // subtrees; its depth is bounded by the tree height.
+  template <class Fn>
+  static void ForEachNode(NodeType* h, Fn fn){
+    NodeType* stack[kMaxHeight];
+    int depth = 0;
+    while (h != NULL || depth > 0){
+      if (h == NULL){
+        h = stack[--depth];
+      }
+      NodeType* left = h->left;
+      if (h->right != NULL){
+        stack[depth++] = h->right;
+      }
+      fn(h);
+      h = left;
+    }
+  }
+
+  ConcurrentLLRBPP(const ConcurrentLLRBPP&);
+  ConcurrentLLRBPP& operator=(const ConcurrentLLRBPP&);
+
+  std::atomic<NodeType*> root_;
+  std::atomic<uint64_t> num_;
+  mutable EpochManager epochs_;
+  mutable std::mutex write_mutex_;
+  uint64_t version_;
+  std::vector<std::pair<uint64_t, NodeType*> > retired_;
+  Alloc<NodeType> alloc_;
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_CONCURRENT_HPP_
@@ -0,0 +1,150 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "llrbppConcurrent.hpp"
+
+using namespace std;
+
+TEST(ConcurrentLLRBPP, trivial){
+  llrbpp::ConcurrentLLRBPP<string, int> fid;
+  EXPECT_FALSE(fid.Contains("aaa"));
+  fid.Insert("aaa", 1);
+  fid.Insert("bbb", 2);
+  fid.Insert("aaa", 3);
+  EXPECT_EQ(2U, fid.Num());
+  EXPECT_EQ(make_pair(true, 3), fid.Find("aaa"));
+  EXPECT_EQ(make_pair(false, 0), fid.Find("ccc"));
+  fid.Delete("aaa");
+  fid.Delete("ccc");
+  EXPECT_FALSE(fid.Contains("aaa"));
+  EXPECT_EQ(1U, fid.Num());
+  fid.Clear();
+  EXPECT_EQ(0U, fid.Num());
+  EXPECT_FALSE(fid.Contains("bbb"));
+  EXPECT_TRUE(fid.IsValid());
+}
+
+TEST(ConcurrentLLRBPP, random){
+  llrbpp::ConcurrentLLRBPP<int, int> fid;
+  map<int, int> m;
+  for (int i = 0; i < 20000; ++i){
+    int key = rand() % 3000;
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+    if (i % 1000 == 0){
+      ASSERT_TRUE(fid.IsValid());
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (int key = 0; key < 3000; ++key){
+    pair<bool, int> ret = fid.Find(key);
+    ASSERT_EQ(m.count(key) > 0, ret.first);
+    if (ret.first){
+      EXPECT_EQ(m[key], ret.second);
+    }
+  }
+  vector<int> keys;
+  fid.ForEachInRange(100, 200, [&keys](int key, int){
+      keys.push_back(key);
+    });
+  vector<int> expected;
+  for (map<int, int>::const_iterator it = m.lower_bound(100);
+       it != m.lower_bound(200); ++it){
+    expected.push_back(it->first);
+  }
+  EXPECT_EQ(expected, keys);
+}
+
+TEST(ConcurrentLLRBPP, clear){
+  llrbpp::ConcurrentLLRBPP<int, string> fid;
+  atomic<bool> done(false);
+  thread reader([&fid, &done](){
+      while (!done.load()){
+        pair<bool, string> ret = fid.Find(12345);
+        if (ret.first){
+          EXPECT_EQ("12345", ret.second);
+        }
+      }
+    });
+  for (int round = 0; round < 3; ++round){
+    for (int i = 0; i < 50000; ++i){
+      fid.Insert(i, to_string(i));
+    }
+    EXPECT_EQ(50000U, fid.Num());
+    fid.Clear();
+    EXPECT_EQ(0U, fid.Num());
+    EXPECT_FALSE(fid.Contains(12345));
+    EXPECT_TRUE(fid.IsValid());
+  }
+  done.store(true);
+  reader.join();
+  fid.Insert(1, "1");
+  EXPECT_EQ(make_pair(true, string("1")), fid.Find(1));
+}
+
+TEST(ConcurrentLLRBPP, readers){
+  // The writer keeps the keys a window [lo, hi) of consecutive integers
+  // with val = key; every version a reader sees must be such a window.
+  // Nodes are freed one by one, so that a reclaimed node still in use
+  // shows up under a memory checker.
+  llrbpp::ConcurrentLLRBPP<int, int, less<int>,
+                           llrbpp::NewDeleteAllocator> fid;
+  const int kKeys = 20000;
+  atomic<bool> done(false);
+  atomic<int> errors(0);
+  vector<thread> readers;
+  for (int r = 0; r < 4; ++r){
+    readers.push_back(thread([&, r](){
+          for (int probe = r; !done.load(); probe = (probe + 7919) % kKeys){
+            int prev = -1;
+            bool ok = true;
+            fid.ForEachInRange(0, kKeys, [&](int key, int val){
+                ok = ok && key == val && (prev < 0 || key == prev + 1);
+                prev = key;
+              });
+            pair<bool, int> ret = fid.Find(probe);
+            ok = ok && (!ret.first || ret.second == probe);
+            if (!ok) ++errors;
+          }
+        }));
+  }
+  for (int i = 0; i < kKeys; ++i){
+    fid.Insert(i, i);
+    if (i >= 1000) fid.Delete(i - 1000);
+  }
+  done = true;
+  for (size_t r = 0; r < readers.size(); ++r){
+    readers[r].join();
+  }
+  EXPECT_EQ(0, errors.load());
+  EXPECT_EQ(1000U, fid.Num());
+  EXPECT_TRUE(fid.IsValid());
+}
@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_EPOCH_HPP_
+#define LLRBPP_EPOCH_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+
+namespace llrbpp{
+
+/**
+ * Epoch-based reclamation for one writer and many readers.
+ * A reader holds a Guard while it follows pointers of shared nodes;
+ * the guard records the global epoch in a slot of its own. The writer
+ * unlinks a node, tags it with Current(), and calls Advance(); the node
+ * may be freed once MinActive() exceeds its tag, because every reader
+ * that entered after the Advance() sees only the new links.
+ * All operations on the epoch and the slots are sequentially consistent,
+ * which is what makes the unlink/Advance/scan of the writer and the
+ * enter/load of a reader never miss each other.
+ * At most kSlots readers are inside at once; more wait for a slot.
+ */
+class EpochManager{
+public:
+  static const size_t kSlots = 128;
+
+  class Guard{
+  public:
+    explicit Guard(EpochManager& manager) :
+      manager_(manager), slot_(manager.Enter()){
+    }
+
+    ~Guard(){
+      manager_.Exit(slot_);
+    }
+
+  private:
+    Guard(const Guard&);
+    Guard& operator=(const Guard&);
+
+    EpochManager& manager_;
+    size_t slot_;
+  };
+
+  EpochManager() : epoch_(1){
+    for (size_t i = 0; i < kSlots; ++i){
+      slots_[i].epoch.store(kIdle);
+    }
+  }
+
+  uint64_t Current() const{
+    return epoch_.load();
+  }
+
+  // Start a new epoch and return it.
+  uint64_t Advance(){
+    return epoch_.fetch_add(1) + 1;
+  }
+
+  // Return the oldest epoch a reader is in, or Current() if none is.
+  uint64_t MinActive() const{
+    uint64_t min_epoch = epoch_.load();
+    for (size_t i = 0; i < kSlots; ++i){
+      uint64_t epoch = slots_[i].epoch.load();
+      if (epoch < min_epoch) min_epoch = epoch;
+    }
+    return min_epoch;
+  }
+
+private:
+  static const uint64_t kIdle = ~0ULL;
+
+  // A reader starts from the slot it used last, so that threads settle
+  // on distinct slots and do not contend for their cache lines.
+  size_t Enter(){
+    static thread_local size_t last = 0;
+    size_t slot = last;
+    for (;;){
+      for (size_t i = 0; i < kSlots; ++i){
+        uint64_t idle = kIdle;
+        if (slots_[slot].epoch.load(std::memory_order_relaxed) == kIdle &&
+            slots_[slot].epoch.compare_exchange_strong(idle, epoch_.load())){
+          last = slot;
+          return slot;
+        }
+        slot = (slot + 1) % kSlots;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  void Exit(size_t slot){
+    slots_[slot].epoch.store(kIdle, std::memory_order_release);
+  }
+
+  struct alignas(64) Slot{
+    std::atomic<uint64_t> epoch;
+  };
+
+  EpochManager(const EpochManager&);
+  EpochManager& operator=(const EpochManager&);
+
+  alignas(64) std::atomic<uint64_t> epoch_;
+  Slot slots_[kSlots];
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_EPOCH_HPP_
@@ -0,0 +1,475 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_FILE_HPP_
+#define LLRBPP_FILE_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "llrbpp.hpp"
+
+namespace llrbpp{
+
+/**
+ * On-disk image of a sorted map with trivially copyable keys and values.
+ *   [0, 64)                 FileHeader
+ *   [keys_offset, ...)      num keys in increasing order
+ *   [vals_offset, ...)      num values, vals[i] for keys[i]
+ * Both arrays start at 64-byte boundaries and the file is padded with
+ * zeros to one; checksum covers [64, file_size). Numbers are in native
+ * byte order, so an image is read on the machine type that wrote it.
+ */
+struct FileHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t key_size;
+  uint32_t val_size;
+  uint32_t reserved;
+  uint64_t num;
+  uint64_t keys_offset;
+  uint64_t vals_offset;
+  uint64_t file_size;
+  uint64_t checksum;
+};
+
+static const char kFileMagic[8] = {'L', 'L', 'R', 'B', 'P', 'P', 'D', 'B'};
+static const uint32_t kFileVersion = 1;
+
+inline uint64_t FileAlign(uint64_t offset){
+  return (offset + 63) & ~static_cast<uint64_t>(63);
+}
+
+// Checksum of the size / 8 words at p, continuing from h.
+inline uint64_t FileChecksum(uint64_t h, const void* p, size_t size){
+  const char* bytes = static_cast<const char*>(p);
+  for (size_t i = 0; i + 8 <= size; i += 8){
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    h ^= word * 0x9E3779B97F4A7C15ULL;
+    h = ((h << 27) | (h >> 37)) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+inline std::string FileError(const std::string& what, const std::string& path){
+  return what + ": " + path + ": " + strerror(errno);
+}
+
+/**
+ * Buffered writer of an image body, checksumming what it writes.
+ * The first sizeof(FileHeader) bytes are reserved and filled by Finish.
+ */
+class FileWriter{
+public:
+  explicit FileWriter(const std::string& path) :
+    path_(path), fp_(fopen(path.c_str(), "wb")), buf_(kBufSize),
+    used_(sizeof(FileHeader)), offset_(0), checksum_(0), ok_(true){
+    if (fp_ == NULL) throw std::runtime_error(FileError("cannot open", path));
+  }
+
+  ~FileWriter(){
+    if (fp_ != NULL) fclose(fp_);
+  }
+
+  void Write(const void* p, size_t size){
+    const char* bytes = static_cast<const char*>(p);
+    while (size > 0){
+      size_t len = std::min(size, buf_.size() - used_);
+      memcpy(&buf_[used_], bytes, len);
+      used_ += len;
+      bytes += len;
+      size -= len;
+      if (used_ == buf_.size()) Flush();
+    }
+  }
+
+  // Write zeros up to offset.
+  void PadTo(uint64_t offset){
+    static const char zeros[64] = {0};
+    while (offset_ + used_ < offset){
+      Write(zeros, std::min<uint64_t>(sizeof(zeros), offset - offset_ - used_));
+    }
+  }
+
+  // Write header with the checksum of the body, ending at a 64-byte
+  // boundary, sync the file to disk and close it. Throws
+  // std::runtime_error on errors.
+  void Finish(FileHeader& header){
+    Flush();
+    header.checksum = checksum_;
+    ok_ = ok_ && fseek(fp_, 0, SEEK_SET) == 0 &&
+      fwrite(&header, 1, sizeof(header), fp_) == sizeof(header) &&
+      fflush(fp_) == 0 && fsync(fileno(fp_)) == 0;
+    ok_ = (fclose(fp_) == 0) && ok_;
+    fp_ = NULL;
+    if (!ok_) throw std::runtime_error(FileError("cannot write", path_));
+  }
+
+private:
+  // a multiple of 8, so that each flush ends at a checksum word
+  static const size_t kBufSize = 1 << 16;
+
+  void Flush(){
+    size_t skip = (offset_ == 0) ? sizeof(FileHeader) : 0;
+    checksum_ = FileChecksum(checksum_, &buf_[skip], used_ - skip);
+    ok_ = ok_ && fwrite(&buf_[0], 1, used_, fp_) == used_;
+    offset_ += used_;
+    used_ = 0;
+  }
+
+  FileWriter(const FileWriter&);
+  FileWriter& operator=(const FileWriter&);
+
+  std::string path_;
+  FILE* fp_;
+  std::vector<char> buf_;
+  size_t used_;
+  uint64_t offset_; // of buf_[0] in the file
+  uint64_t checksum_;
+  bool ok_;
+};
+
+// Sync the directory holding path, so that a rename into it is durable.
+inline bool SyncParentDir(const std::string& path){
+  std::string::size_type slash = path.rfind('/');
+  std::string dir = (slash == std::string::npos) ? "." :
+    (slash == 0) ? "/" : path.substr(0, slash);
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = (fsync(fd) == 0);
+  return (close(fd) == 0) && ok;
+}
+
+/**
+ * Write an image of num entries to path. for_each(fn) must call
+ * fn(key, val) for the entries in increasing key order; it is called
+ * twice. The image is written and synced to path + ".tmp", renamed to
+ * path, and the directory is synced, so that path holds either the old
+ * or the new image even after a crash.
+ * Throws std::runtime_error on I/O errors.
+ */
+template <class Key, class Val, class ForEach>
+void WriteSortedFile(const std::string& path, uint64_t num, ForEach for_each){
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                std::is_trivially_copyable<Val>::value,
+                "keys and values must be trivially copyable");
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kFileMagic, sizeof(header.magic));
+  header.version = kFileVersion;
+  header.key_size = sizeof(Key);
+  header.val_size = sizeof(Val);
+  header.num = num;
+  header.keys_offset = FileAlign(sizeof(FileHeader));
+  header.vals_offset = FileAlign(header.keys_offset + num * sizeof(Key));
+  header.file_size = FileAlign(header.vals_offset + num * sizeof(Val));
+
+  std::string tmp_path = path + ".tmp";
+  try{
+    FileWriter writer(tmp_path);
+    writer.PadTo(header.keys_offset);
+    for_each([&writer](const Key& key, const Val&){
+        writer.Write(&key, sizeof(Key));
+      });
+    writer.PadTo(header.vals_offset);
+    for_each([&writer](const Key&, const Val& val){
+        writer.Write(&val, sizeof(Val));
+      });
+    writer.PadTo(header.file_size);
+    writer.Finish(header);
+  } catch (...){
+    unlink(tmp_path.c_str());
+    throw;
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0){
+    std::string error = FileError("cannot rename", tmp_path);
+    unlink(tmp_path.c_str());
+    throw std::runtime_error(error);
+  }
+  if (!SyncParentDir(path)){
+    throw std::runtime_error(FileError("cannot sync directory of", path));
+  }
+}
+
+/**
+ * Read-only mapping of an image written by WriteSortedFile.
+ * The header is always validated; the checksum is verified if verify
+ * is true, which reads the whole file.
+ * Throws std::runtime_error if the file cannot be mapped or is not an
+ * image of Key and Val.
+ */
+template <class Key, class Val>
+class MappedFile{
+public:
+  MappedFile(const std::string& path, bool verify) : data_(NULL), size_(0){
+    static_assert(std::is_trivially_copyable<Key>::value &&
+                  std::is_trivially_copyable<Val>::value,
+                  "keys and values must be trivially copyable");
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error(FileError("cannot open", path));
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+      std::string error = FileError("cannot stat", path);
+      close(fd);
+      throw std::runtime_error(error);
+    }
+    size_ = st.st_size;
+    if (size_ >= sizeof(FileHeader)){
+      data_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (data_ == MAP_FAILED){
+        data_ = NULL;
+        std::string error = FileError("cannot map", path);
+        close(fd);
+        throw std::runtime_error(error);
+      }
+    }
+    close(fd);
+    const char* what = Validate(verify);
+    if (what != NULL){
+      if (data_ != NULL) munmap(data_, size_);
+      data_ = NULL;
+      throw std::runtime_error(std::string(what) + ": " + path);
+    }
+  }
+
+  ~MappedFile(){
+    if (data_ != NULL) munmap(data_, size_);
+  }
+
+  const FileHeader& Header() const{
+    return *static_cast<const FileHeader*>(data_);
+  }
+
+  const Key* Keys() const{
+    return reinterpret_cast<const Key*>(Bytes() + Header().keys_offset);
+  }
+
+  const Val* Vals() const{
+    return reinterpret_cast<const Val*>(Bytes() + Header().vals_offset);
+  }
+
+private:
+  const char* Bytes() const{
+    return static_cast<const char*>(data_);
+  }
+
+  // Return NULL if the image is valid, or what is wrong.
+  const char* Validate(bool verify) const{
+    if (data_ == NULL) return "truncated image";
+    const FileHeader& header = Header();
+    if (memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0){
+      return "not an llrbpp image";
+    }
+    if (header.version != kFileVersion) return "unsupported image version";
+    if (header.key_size != sizeof(Key) || header.val_size != sizeof(Val)){
+      return "key or value size mismatch";
+    }
+    uint64_t num = header.num;
+    if (num > size_ / sizeof(Key) || num > size_ / sizeof(Val) ||
+        header.keys_offset != FileAlign(sizeof(FileHeader)) ||
+        header.vals_offset != FileAlign(header.keys_offset + num * sizeof(Key)) ||
+        header.file_size != FileAlign(header.vals_offset + num * sizeof(Val)) ||
+        header.file_size != size_){
+      return "corrupt image layout";
+    }
+    if (verify && FileChecksum(0, Bytes() + sizeof(FileHeader),
+                               size_ - sizeof(FileHeader)) != header.checksum){
+      return "checksum mismatch";
+    }
+    return NULL;
+  }
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  void* data_;
+  size_t size_;
+};
+
+/**
+ * Forward iterator over the entries of a mapped image as (key, val)
+ * pairs, to feed BuildFromSorted.
+ */
+template <class Key, class Val>
+class ImageIterator{
+public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef std::pair<Key, Val> value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const value_type* pointer;
+  typedef const value_type& reference;
+
+  ImageIterator(const Key* keys, const Val* vals, uint64_t pos) :
+    keys_(keys), vals_(vals), pos_(pos){
+  }
+
+  reference operator*() const{
+    entry_.first = keys_[pos_];
+    entry_.second = vals_[pos_];
+    return entry_;
+  }
+
+  pointer operator->() const{
+    return &**this;
+  }
+
+  ImageIterator& operator++(){
+    ++pos_;
+    return *this;
+  }
+
+  ImageIterator operator++(int){
+    ImageIterator it = *this;
+    ++pos_;
+    return it;
+  }
+
+  bool operator==(const ImageIterator& it) const{
+    return pos_ == it.pos_;
+  }
+
+  bool operator!=(const ImageIterator& it) const{
+    return pos_ != it.pos_;
+  }
+
+private:
+  const Key* keys_;
+  const Val* vals_;
+  uint64_t pos_;
+  mutable value_type entry_;
+};
+
+/**
+ * Write the contents of tree to path as a versioned, checksummed image
+ * of the sorted key and value arrays. Key and Val must be trivially
+ * copyable. Throws std::runtime_error on I/O errors.
+ */
+template <class Key, class Val, class Comp,
+          template <class> class Alloc, class Aug>
+void SaveImage(const LLRBPP<Key, Val, Comp, Alloc, Aug>& tree,
+               const std::string& path){
+  typedef typename LLRBPP<Key, Val, Comp, Alloc, Aug>::Iterator Iterator;
+  WriteSortedFile<Key, Val>(path, tree.Num(), [&tree](auto fn){
+      for (Iterator it = tree.Begin(); it != tree.End(); ++it){
+        fn(it.GetKey(), it.GetVal());
+      }
+    });
+}
+
+/**
+ * Replace the contents of tree with an image written by SaveImage,
+ * building the tree in O(n) as BuildFromSorted. The image must have
+ * been saved with the same Comp. Throws std::runtime_error if the file
+ * cannot be read, is not an image of Key and Val, or fails its
+ * checksum; tree is then unchanged.
+ */
+template <class Key, class Val, class Comp,
+          template <class> class Alloc, class Aug>
+void LoadImage(LLRBPP<Key, Val, Comp, Alloc, Aug>& tree,
+               const std::string& path){
+  MappedFile<Key, Val> file(path, true);
+  uint64_t num = file.Header().num;
+  tree.BuildFromSorted(ImageIterator<Key, Val>(file.Keys(), file.Vals(), 0),
+                       ImageIterator<Key, Val>(file.Keys(), file.Vals(), num));
+}
+
+/**
+ * Read-only map served directly from an image file mapped in memory.
+ * Opening costs no deserialization: lookups run a branch-free binary
+ * search over the mapped key array, prefetching both possible next
+ * probes, and pages are read in on demand.
+ */
+template <class Key, class Val, class Comp = std::less<Key> >
+class MappedLLRBPP{
+public:
+  explicit MappedLLRBPP(const std::string& path, bool verify = true) :
+    file_(path, verify), keys_(file_.Keys()), vals_(file_.Vals()),
+    num_(file_.Header().num){
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  std::pair<bool, Val> Find(const Key& key) const{
+    const Val* val = FindPtr(key);
+    if (val == NULL) return std::make_pair(false, Val());
+    return std::make_pair(true, *val);
+  }
+
+  // Return a pointer into the mapping, or NULL if key does not exist.
+  const Val* FindPtr(const Key& key) const{
+    uint64_t i = LowerBoundIndex(key);
+    if (i == num_ || Comp()(key, keys_[i])) return NULL;
+    return &vals_[i];
+  }
+
+  bool Contains(const Key& key) const{
+    return FindPtr(key) != NULL;
+  }
+
+  // Call fn(key, val) for every key in [lo, hi) in ascending order.
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    for (uint64_t i = LowerBoundIndex(lo); i < num_ && Comp()(keys_[i], hi); ++i){
+      fn(keys_[i], vals_[i]);
+    }
+  }
+
+  uint64_t Num() const {
+    return num_;
+  }
+
+private:
+  // Return the index of the first key not less than key.
+  uint64_t LowerBoundIndex(const Key& key) const{
+    if (num_ == 0) return 0;
+    const Key* base = keys_;
+    uint64_t n = num_;
+    while (n > 1){
+      uint64_t half = n / 2;
+      __builtin_prefetch(base + half / 2);
+      __builtin_prefetch(base + half + half / 2);
+      base = Comp()(base[half], key) ? base + half : base;
+      n -= half;
+    }
+    return (base - keys_) + Comp()(*base, key);
+  }
+
+  MappedFile<Key, Val> file_;
+  const Key* keys_;
+  const Val* vals_;
+  uint64_t num_;
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_FILE_HPP_
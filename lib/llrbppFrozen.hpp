@@ -0,0 +1,173 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_FROZEN_HPP_
+#define LLRBPP_FROZEN_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "llrbpp.hpp"
+
+namespace llrbpp{
+
+/**
+ * Immutable snapshot of a sorted map in Eytzinger (BFS) order.
+ * The entry of implicit node k (1-origin) is at keys_[k] and vals_[k],
+ * and its children are 2k and 2k+1, so the array holds no pointers and
+ * the top levels of every search share the same few cache lines.
+ * A search is branch-free, computing the next node from the comparison
+ * result, and prefetches the cache line holding the descendants
+ * kPrefetchLevels below, so the misses of consecutive levels overlap.
+ * Obtained by Freeze(tree) or BuildFromSorted().
+ */
+template <class Key, class Val, class Comp = std::less<Key> >
+class FrozenLLRBPP{
+public:
+  FrozenLLRBPP() : num_(0){
+  }
+
+  /**
+   * Replace the contents with num entries in increasing key order;
+   * fill(key, val) assigns the next entry to key and val.
+   */
+  template <class Fill>
+  void Build(uint64_t num, Fill fill){
+    keys_.assign(num + 1, Key());
+    vals_.assign(num + 1, Val());
+    num_ = num;
+    for (uint64_t k = First(); k != 0; k = Next(k)){
+      fill(keys_[k], vals_[k]);
+    }
+  }
+
+  // Replace the contents with the (key, val) pairs in [begin, end),
+  // sorted by strictly increasing keys.
+  template <class ForwardIterator>
+  void BuildFromSorted(ForwardIterator begin, ForwardIterator end){
+    Build(std::distance(begin, end), [&begin](Key& key, Val& val){
+        key = begin->first;
+        val = begin->second;
+        ++begin;
+      });
+  }
+
+  void Clear(){
+    std::vector<Key>().swap(keys_);
+    std::vector<Val>().swap(vals_);
+    num_ = 0;
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  std::pair<bool, Val> Find(const Key& key) const{
+    const Val* val = FindPtr(key);
+    if (val == NULL) return std::make_pair(false, Val());
+    return std::make_pair(true, *val);
+  }
+
+  // Return a pointer to the value of key, or NULL if key does not exist.
+  const Val* FindPtr(const Key& key) const{
+    uint64_t k = LowerBoundIndex(key);
+    if (k == 0 || Comp()(key, keys_[k])) return NULL;
+    return &vals_[k];
+  }
+
+  bool Contains(const Key& key) const{
+    return FindPtr(key) != NULL;
+  }
+
+  // Call fn(key, val) for every key in [lo, hi) in ascending order.
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    for (uint64_t k = LowerBoundIndex(lo); k != 0; k = Next(k)){
+      if (!Comp()(keys_[k], hi)) break;
+      fn(keys_[k], vals_[k]);
+    }
+  }
+
+  uint64_t Num() const {
+    return num_;
+  }
+
+private:
+  // One prefetch covers the 2^kPrefetchLevels descendants that many
+  // levels below, which lie next to each other.
+  static const int kPrefetchLevels =
+    (sizeof(Key) <= 4) ? 4 : (sizeof(Key) <= 8) ? 3 : (sizeof(Key) <= 16) ? 2 : 1;
+
+  // Return the node of the first key not less than key, or 0.
+  uint64_t LowerBoundIndex(const Key& key) const{
+    const Key* keys = keys_.data();
+    uint64_t k = 1;
+    while (k <= num_){
+      __builtin_prefetch(keys + (k << kPrefetchLevels));
+      k = 2 * k + Comp()(keys[k], key);
+    }
+    // the path went right below the answer and left ever since;
+    // drop those trailing right turns and the last left turn
+    return k >> __builtin_ffsll(~k);
+  }
+
+  // The in-order first node and successor of node k, 0 at the end.
+  uint64_t First() const{
+    if (num_ == 0) return 0;
+    uint64_t k = 1;
+    while (2 * k <= num_) k = 2 * k;
+    return k;
+  }
+
+  uint64_t Next(uint64_t k) const{
+    if (2 * k + 1 <= num_){
+      k = 2 * k + 1;
+      while (2 * k <= num_) k = 2 * k;
+      return k;
+    }
+    while (k & 1) k >>= 1;
+    return k >> 1;
+  }
+
+  std::vector<Key> keys_;
+  std::vector<Val> vals_;
+  uint64_t num_;
+};
+
+/**
+ * Return an immutable copy of the current contents of tree laid out for
+ * fast lookups; the tree stays usable and later updates do not affect
+ * it. O(n) time, and the snapshot holds no pointers into the tree.
+ */
+template <class Key, class Val, class Comp,
+          template <class> class Alloc, class Aug>
+FrozenLLRBPP<Key, Val, Comp> Freeze(const LLRBPP<Key, Val, Comp, Alloc, Aug>& tree){
+  FrozenLLRBPP<Key, Val, Comp> frozen;
+  typename LLRBPP<Key, Val, Comp, Alloc, Aug>::Iterator it = tree.Begin();
+  frozen.Build(tree.Num(), [&it](Key& key, Val& val){
+      key = it.GetKey();
+      val = it.GetVal();
+      ++it;
+    });
+  return frozen;
+}
+
+} // namespace llrbpp
+
+#endif // LLRBPP_FROZEN_HPP_
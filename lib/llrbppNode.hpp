@@ -21,21 +21,22 @@
 #define LLRBPP_NODE_HPP_
 
 #include <stdio.h> // NULL
+#include <utility>
+#include "llrbppAugment.hpp"
 
 namespace llrbpp{
 
 const static bool kRED = true;
 const static bool kBLACK = false;
 
-template <class K, class V>
-struct Node{
-  Node(K key, V val) : 
-    key(key), val(val), left(NULL), right(NULL), color(kRED) {}
-
-  ~Node(){
-    delete left;
-    delete right;
-  }
+template <class K, class V, class Aug = NoAugment>
+struct Node : public Aug::Data{
+  // key is built from key_arg and val from val_args in place.
+  template <class KeyArg, class... ValArgs>
+  explicit Node(KeyArg&& key_arg, ValArgs&&... val_args) :
+    key(std::forward<KeyArg>(key_arg)),
+    val(std::forward<ValArgs>(val_args)...),
+    left(NULL), right(NULL), color(kRED) {}
 
   K key;
   V val;
@@ -0,0 +1,225 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_PATH_COPY_HPP_
+#define LLRBPP_PATH_COPY_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include "llrbppCompare.hpp"
+#include "llrbppNode.hpp"
+
+namespace llrbpp{
+
+/**
+ * Recursive left-leaning red-black tree algorithms for trees whose
+ * updates must not modify nodes that other versions may still see.
+ * Before changing a node, an update calls Derived::Own(node), which
+ * returns the node itself if the update may modify it and a copy
+ * otherwise; the caller links the result in place of the node.
+ * Derived also provides NewNode(key, val) and Unlink(node), which drops
+ * a node the update removes, and befriends this class.
+ * NodeType has key, val, left, right and color.
+ */
+template <class Derived, class NodeType, class Key, class Val, class Comp>
+class PathCopyLLRB{
+protected:
+  static bool IsRED(const NodeType* node){
+    return node != NULL && node->color == kRED;
+  }
+
+  // The descent of LLRBPP::FindNode.
+  static const NodeType* FindNode(const NodeType* node, const Key& key){
+    typedef ThreeWay<Comp, Key, Key> Cmp;
+    if (Cmp::kEnabled){
+      while (node != NULL){
+        int cmp = Cmp::Compare(key, node->key);
+        if (cmp == 0) return node;
+        node = (cmp < 0) ? node->left : node->right;
+      }
+      return NULL;
+    }
+    const NodeType* cand = NULL;
+    while (node != NULL){
+      if (Comp()(node->key, key)){
+        node = node->right;
+      } else {
+        cand = node;
+        node = node->left;
+      }
+    }
+    if (cand == NULL || Comp()(key, cand->key)) return NULL;
+    return cand;
+  }
+
+  // The helpers below take nodes owned by the update unless noted, and
+  // Own the other nodes they modify.
+  NodeType* RotateLeft(NodeType* h){
+    NodeType* x = Self().Own(h->right);
+    h->right = x->left;
+    x->left = h;
+    x->color = h->color;
+    h->color = kRED;
+    return x;
+  }
+
+  NodeType* RotateRight(NodeType* h){
+    NodeType* x = Self().Own(h->left);
+    h->left = x->right;
+    x->right = h;
+    x->color = h->color;
+    h->color = kRED;
+    return x;
+  }
+
+  void FlipColors(NodeType* h){
+    h->left = Self().Own(h->left);
+    h->right = Self().Own(h->right);
+    h->color = !h->color;
+    h->left->color = !h->left->color;
+    h->right->color = !h->right->color;
+  }
+
+  NodeType* FixUp(NodeType* h){
+    if (IsRED(h->right)) h = RotateLeft(h);
+    if (IsRED(h->left) && IsRED(h->left->left)) h = RotateRight(h);
+    if (IsRED(h->left) && IsRED(h->right)) FlipColors(h);
+    return h;
+  }
+
+  NodeType* MoveREDLeft(NodeType* h){
+    FlipColors(h);
+    if (IsRED(h->right->left)){
+      h->right = RotateRight(h->right);
+      h = RotateLeft(h);
+      FlipColors(h);
+    }
+    return h;
+  }
+
+  NodeType* MoveREDRight(NodeType* h){
+    FlipColors(h);
+    if (IsRED(h->left->left)){
+      h = RotateRight(h);
+      FlipColors(h);
+    }
+    return h;
+  }
+
+  // h may be shared or NULL. cand is the last node left to the right,
+  // the only one on the path that can hold key; it is tested for
+  // equality at the bottom so that each level makes one Comp call.
+  // inserted is set if key was new.
+  NodeType* InsertInternal(NodeType* h, const Key& key, const Val& val,
+                           NodeType* cand, bool& inserted){
+    if (h == NULL){
+      if (cand != NULL && !Comp()(cand->key, key)){
+        cand->val = val;
+        return NULL;
+      }
+      inserted = true;
+      return Self().NewNode(key, val);
+    }
+    h = Self().Own(h);
+    if (Comp()(key, h->key)){
+      h->left = InsertInternal(h->left, key, val, cand, inserted);
+    } else {
+      h->right = InsertInternal(h->right, key, val, h, inserted);
+    }
+    if (IsRED(h->right) && !IsRED(h->left)) h = RotateLeft(h);
+    if (IsRED(h->left) && IsRED(h->left->left)) h = RotateRight(h);
+    if (IsRED(h->left) && IsRED(h->right)) FlipColors(h);
+    return h;
+  }
+
+  // h may be shared and is not NULL. As InsertInternal, each level makes
+  // one Comp call: if cand holds key, every later step goes left, down
+  // to the minimum of its right subtree, whose entry replaces that of
+  // cand. deleted is set if key was found.
+  NodeType* DeleteInternal(NodeType* h, const Key& key, NodeType* cand,
+                           bool& deleted){
+    if (Comp()(key, h->key)){
+      if (h->left == NULL){
+        if (cand == NULL || Comp()(cand->key, key)) return h;
+        cand->key = h->key;
+        cand->val = h->val;
+        Self().Unlink(h);
+        deleted = true;
+        return NULL;
+      }
+      h = Self().Own(h);
+      if (!IsRED(h->left) && !IsRED(h->left->left)){
+        h = MoveREDLeft(h);
+      }
+      h->left = DeleteInternal(h->left, key, cand, deleted);
+      return FixUp(h);
+    }
+    if (!IsRED(h->left) && h->right == NULL){
+      // a leaf; a rotation would bring up a smaller key
+      if (Comp()(h->key, key)) return h;
+      Self().Unlink(h);
+      deleted = true;
+      return NULL;
+    }
+    h = Self().Own(h);
+    if (IsRED(h->left)){
+      h = RotateRight(h);
+    }
+    if (!IsRED(h->right) && !IsRED(h->right->left)){
+      h = MoveREDRight(h);
+    }
+    h->right = DeleteInternal(h->right, key, h, deleted);
+    return FixUp(h);
+  }
+
+  template <class Fn>
+  static void ForEachInRangeInternal(const NodeType* node, const Key& lo,
+                                     const Key& hi, Fn& fn){
+    if (node == NULL) return;
+    bool above_lo = !Comp()(node->key, lo);
+    if (above_lo) ForEachInRangeInternal(node->left, lo, hi, fn);
+    if (!Comp()(node->key, hi)) return;
+    if (above_lo) fn(node->key, node->val);
+    ForEachInRangeInternal(node->right, lo, hi, fn);
+  }
+
+  // Return the black height, or -1 if the subtree is invalid.
+  static int IsValidInternal(const NodeType* node, const Key* lo,
+                             const Key* hi, uint64_t& num){
+    if (node == NULL) return 0;
+    if (lo != NULL && !Comp()(*lo, node->key)) return -1;
+    if (hi != NULL && !Comp()(node->key, *hi)) return -1;
+    if (IsRED(node->right)) return -1;
+    if (IsRED(node) && IsRED(node->left)) return -1;
+    ++num;
+    int left = IsValidInternal(node->left, lo, &node->key, num);
+    int right = IsValidInternal(node->right, &node->key, hi, num);
+    if (left < 0 || left != right) return -1;
+    return left + (IsRED(node) ? 0 : 1);
+  }
+
+private:
+  Derived& Self(){
+    return static_cast<Derived&>(*this);
+  }
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_PATH_COPY_HPP_
@@ -0,0 +1,222 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_PERSISTENT_HPP_
+#define LLRBPP_PERSISTENT_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include <atomic>
+#include <functional>
+#include <new>
+#include <utility>
+#include "llrbppNode.hpp"
+#include "llrbppPathCopy.hpp"
+#include "llrbppPool.hpp"
+
+namespace llrbpp{
+
+template <class K, class V>
+struct PersistentNode{
+  PersistentNode(const K& key, const V& val) :
+    key(key), val(val), left(NULL), right(NULL), color(kRED), refs(1) {}
+
+  K key;
+  V val;
+  PersistentNode* left;
+  PersistentNode* right;
+  bool color;
+  std::atomic<uint32_t> refs; // the links to this node from parents and roots
+};
+
+/**
+ * Persistent left-leaning red-black tree.
+ * Copies share all nodes, so a copy or Snapshot() costs O(1). Nodes are
+ * reference-counted: an update modifies a node in place if this tree
+ * holds the only link to it, and copies it otherwise, so updates copy at
+ * most the O(log n) nodes on their paths and none when no other version
+ * exists. Every version stays unchanged by updates to the others and
+ * frees its nodes when the last version holding them goes away.
+ * A tree object is not thread-safe, but distinct copies may be used by
+ * distinct threads; the copy itself is made while the source is not
+ * being updated. Each copy frees into its own allocator, which shares
+ * the storage of the source through Alloc::Share; with NodePool, the
+ * slots a copy frees return to the shared arena when the copy goes away,
+ * so that taking and dropping snapshots does not grow the storage.
+ */
+template <class Key, class Val, class Comp = std::less<Key>,
+          template <class> class Alloc = NodePool>
+class PersistentLLRBPP :
+    private PathCopyLLRB<PersistentLLRBPP<Key, Val, Comp, Alloc>,
+                         PersistentNode<Key, Val>, Key, Val, Comp>{
+  typedef PersistentNode<Key, Val> NodeType;
+  typedef PathCopyLLRB<PersistentLLRBPP, NodeType, Key, Val, Comp> Base;
+  friend Base;
+  using Base::IsRED;
+  using Base::FindNode;
+
+public:
+  PersistentLLRBPP() : root_(NULL), num_(0){
+  }
+
+  PersistentLLRBPP(const PersistentLLRBPP& other) :
+    root_(other.root_), num_(other.num_){
+    alloc_.Share(other.alloc_);
+    Ref(root_);
+  }
+
+  PersistentLLRBPP& operator=(const PersistentLLRBPP& other){
+    if (this != &other){
+      alloc_.Share(other.alloc_);
+      Ref(other.root_);
+      Unref(root_);
+      root_ = other.root_;
+      num_ = other.num_;
+    }
+    return *this;
+  }
+
+  ~PersistentLLRBPP(){
+    Unref(root_);
+  }
+
+  // Return a copy of the current version in O(1). Later updates of
+  // either tree do not affect the other.
+  PersistentLLRBPP Snapshot() const{
+    return *this;
+  }
+
+  void Insert(const Key& key, const Val& val){
+    bool inserted = false;
+    root_ = this->InsertInternal(root_, key, val, NULL, inserted);
+    root_->color = kBLACK;
+    if (inserted) ++num_;
+  }
+
+  void Delete(const Key& key){
+    if (root_ == NULL) return;
+    if (!IsRED(root_->left) && !IsRED(root_->right)){
+      root_ = Own(root_);
+      root_->color = kRED;
+    }
+    bool deleted = false;
+    root_ = this->DeleteInternal(root_, key, NULL, deleted);
+    if (root_ != NULL){
+      root_->color = kBLACK;
+    }
+    if (deleted) --num_;
+  }
+
+  void Clear(){
+    Unref(root_);
+    root_ = NULL;
+    num_ = 0;
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  std::pair<bool, Val> Find(const Key& key) const{
+    const NodeType* node = FindNode(root_, key);
+    if (node == NULL) return std::make_pair(false, Val());
+    return std::make_pair(true, node->val);
+  }
+
+  // Return a pointer to the value of key, or NULL if key does not exist.
+  // The pointer stays valid until this tree changes the entry.
+  const Val* FindPtr(const Key& key) const{
+    const NodeType* node = FindNode(root_, key);
+    return (node == NULL) ? NULL : &node->val;
+  }
+
+  bool Contains(const Key& key) const{
+    return FindNode(root_, key) != NULL;
+  }
+
+  // Call fn(key, val) for every key in [lo, hi) in ascending order.
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    Base::ForEachInRangeInternal(root_, lo, hi, fn);
+  }
+
+  uint64_t Num() const {
+    return num_;
+  }
+
+  const Alloc<NodeType>& GetAllocator() const{
+    return alloc_;
+  }
+
+  // Return true iff the tree is a valid left-leaning red-black tree.
+  bool IsValid() const{
+    uint64_t num = 0;
+    return !IsRED(root_) && Base::IsValidInternal(root_, NULL, NULL, num) >= 0 &&
+      num == num_;
+  }
+
+private:
+  NodeType* NewNode(const Key& key, const Val& val){
+    return new(alloc_.Allocate()) NodeType(key, val);
+  }
+
+  // Return node itself if this tree holds the only link to it, or a
+  // copy of it linked to the same children; the caller relinks the
+  // result in place of node. An update Owns the nodes on its path top
+  // down, so a node whose parent has just been copied has another link
+  // and is copied in turn.
+  NodeType* Own(NodeType* node){
+    if (node->refs.load(std::memory_order_acquire) == 1) return node;
+    NodeType* copy = NewNode(node->key, node->val);
+    copy->left = node->left;
+    copy->right = node->right;
+    copy->color = node->color;
+    Ref(copy->left);
+    Ref(copy->right);
+    Unref(node);
+    return copy;
+  }
+
+  void Unlink(NodeType* node){
+    Unref(node);
+  }
+
+  static void Ref(NodeType* node){
+    if (node != NULL){
+      node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Drop one link to node, freeing the nodes no version links anymore.
+  void Unref(NodeType* node){
+    while (node != NULL &&
+           node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+      Unref(node->left);
+      NodeType* right = node->right;
+      node->~NodeType();
+      alloc_.Deallocate(node);
+      node = right;
+    }
+  }
+
+  NodeType* root_;
+  uint64_t num_;
+  Alloc<NodeType> alloc_;
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_PERSISTENT_HPP_
@@ -0,0 +1,262 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "llrbppCompact.hpp"
+#include "llrbppPersistent.hpp"
+
+using namespace std;
+
+namespace {
+
+// a value counting its live instances
+struct Counted{
+  static int live;
+  Counted(int v = 0) : v(v){
+    ++live;
+  }
+  Counted(const Counted& c) : v(c.v){
+    ++live;
+  }
+  Counted& operator=(const Counted& c){
+    v = c.v;
+    return *this;
+  }
+  ~Counted(){
+    --live;
+  }
+  int v;
+};
+
+int Counted::live = 0;
+
+template <class Tree>
+void CheckSame(const Tree& fid, const map<int, int>& m){
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  typedef vector<pair<int, int> > KVs;
+  KVs kvs;
+  fid.ForEachInRange(0, 1 << 30, [&kvs](int key, int val){
+      kvs.push_back(make_pair(key, val));
+    });
+  EXPECT_EQ(KVs(m.begin(), m.end()), kvs);
+}
+
+}
+
+TEST(PersistentLLRBPP, trivial){
+  llrbpp::PersistentLLRBPP<int, int> fid;
+  fid.Insert(1, 10);
+  fid.Insert(2, 20);
+  llrbpp::PersistentLLRBPP<int, int> snap = fid.Snapshot();
+  fid.Insert(1, 11);
+  fid.Delete(2);
+  fid.Insert(3, 30);
+  EXPECT_EQ(make_pair(true, 11), fid.Find(1));
+  EXPECT_FALSE(fid.Contains(2));
+  EXPECT_EQ(make_pair(true, 10), snap.Find(1));
+  ASSERT_TRUE(snap.FindPtr(2) != NULL);
+  EXPECT_EQ(20, *snap.FindPtr(2));
+  EXPECT_FALSE(snap.Contains(3));
+  EXPECT_EQ(2U, snap.Num());
+  EXPECT_EQ(2U, fid.Num());
+  fid.Clear();
+  EXPECT_EQ(0U, fid.Num());
+  EXPECT_TRUE(snap.Contains(1));
+}
+
+TEST(PersistentLLRBPP, snapshots){
+  llrbpp::PersistentLLRBPP<int, int> fid;
+  map<int, int> m;
+  vector<llrbpp::PersistentLLRBPP<int, int> > snaps;
+  vector<map<int, int> > snap_maps;
+  for (int i = 0; i < 20000; ++i){
+    int key = rand() % 3000;
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+    if (i % 1000 == 0){
+      snaps.push_back(fid.Snapshot());
+      snap_maps.push_back(m);
+    }
+    if (i % 3000 == 0 && !snaps.empty()){
+      // a snapshot may be updated as well, without affecting the others
+      snaps[0].Insert(-1, i);
+      snap_maps[0][-1] = i;
+      snaps[0].Delete(snap_maps[0].rbegin()->first);
+      snap_maps[0].erase(snap_maps[0].rbegin()->first);
+    }
+  }
+  CheckSame(fid, m);
+  for (size_t i = 0; i < snaps.size(); ++i){
+    CheckSame(snaps[i], snap_maps[i]);
+  }
+  snaps[3] = snaps[5];
+  CheckSame(snaps[3], snap_maps[5]);
+}
+
+// orders strings and counts the calls, without a three-way Compare
+struct CountingLess{
+  bool operator()(const string& a, const string& b) const{
+    ++count;
+    return a < b;
+  }
+  static int count;
+};
+int CountingLess::count = 0;
+
+TEST(PersistentLLRBPP, comparecount){
+  // updates apply the transformations of CompactLLRBPP and make the same
+  // Comp calls, one per level, also when they copy shared nodes
+  typedef llrbpp::PersistentLLRBPP<string, int, CountingLess> Tree;
+  Tree fid;
+  llrbpp::CompactLLRBPP<string, int, CountingLess> ref;
+  map<string, int> m;
+  Tree snap;
+  for (int i = 0; i < 20000; ++i){
+    string key = to_string(rand() % 3000);
+    bool del = (rand() % 3 == 0);
+    CountingLess::count = 0;
+    if (del){
+      ref.Delete(key);
+    } else {
+      ref.Insert(key, i);
+    }
+    int ref_count = CountingLess::count;
+    CountingLess::count = 0;
+    if (del){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+    ASSERT_EQ(ref_count, CountingLess::count) << " i=" << i;
+    if (i % 1000 == 0){
+      snap = fid.Snapshot();
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (map<string, int>::const_iterator it = m.begin(); it != m.end(); ++it){
+    EXPECT_EQ(make_pair(true, it->second), fid.Find(it->first));
+  }
+}
+
+TEST(PersistentLLRBPP, release){
+  {
+    llrbpp::PersistentLLRBPP<int, Counted, less<int>,
+                             llrbpp::NewDeleteAllocator> fid;
+    vector<llrbpp::PersistentLLRBPP<int, Counted, less<int>,
+                                    llrbpp::NewDeleteAllocator> > snaps;
+    for (int i = 0; i < 5000; ++i){
+      fid.Insert(rand() % 1000, Counted(i));
+      fid.Delete(rand() % 1000);
+      if (i % 500 == 0) snaps.push_back(fid.Snapshot());
+    }
+    // without other versions, updates copy nothing and the entries stay
+    // where they are; with a snapshot, the path to the new key is copied
+    snaps.clear();
+    vector<const Counted*> ptrs(1000);
+    for (int key = 0; key < 1000; ++key){
+      ptrs[key] = fid.FindPtr(key);
+    }
+    fid.Insert(1000, Counted(0));
+    int moved = 0;
+    for (int key = 0; key < 1000; ++key){
+      moved += (fid.FindPtr(key) != ptrs[key]);
+    }
+    EXPECT_EQ(0, moved);
+    snaps.push_back(fid.Snapshot());
+    fid.Insert(1001, Counted(0));
+    for (int key = 0; key < 1000; ++key){
+      moved += (fid.FindPtr(key) != ptrs[key]);
+      if (snaps[0].FindPtr(key) != ptrs[key]) ++moved;
+    }
+    EXPECT_LT(0, moved);
+  }
+  EXPECT_EQ(0, Counted::live);
+}
+
+TEST(PersistentLLRBPP, snapshotchurn){
+  // the nodes a dropped snapshot frees are reused by the writer, also
+  // when the snapshot is dropped by another thread
+  typedef llrbpp::PersistentLLRBPP<int, int> Tree;
+  Tree fid;
+  map<int, int> m;
+  for (int i = 0; i < 10000; ++i){
+    fid.Insert(i, i);
+    m[i] = i;
+  }
+  size_t slab_num = 0;
+  for (int round = 0; round < 200; ++round){
+    Tree snap = fid.Snapshot();
+    for (int i = 0; i < 200; ++i){
+      int key = rand() % 10000;
+      fid.Delete(key);
+      fid.Insert(key, round);
+      m[key] = round;
+    }
+    if (round % 2 == 0){
+      thread dropper([snap](){
+          EXPECT_EQ(10000, snap.Num());
+        });
+      snap.Clear();
+      dropper.join();
+    }
+    if (round == 20){
+      slab_num = fid.GetAllocator().SlabNum();
+    }
+  }
+  CheckSame(fid, m);
+  EXPECT_EQ(slab_num, fid.GetAllocator().SlabNum());
+}
+
+TEST(PersistentLLRBPP, scanthread){
+  // a scan in another thread sees its snapshot while writes continue
+  llrbpp::PersistentLLRBPP<int, int> fid;
+  for (int i = 0; i < 10000; ++i){
+    fid.Insert(i, i);
+  }
+  llrbpp::PersistentLLRBPP<int, int> snap = fid.Snapshot();
+  int64_t sum = 0;
+  thread scanner([&snap, &sum](){
+      for (int round = 0; round < 20; ++round){
+        snap.ForEachInRange(0, 10000, [&sum](int, int val){
+            sum += val;
+          });
+      }
+    });
+  for (int i = 0; i < 10000; ++i){
+    fid.Delete(i);
+    fid.Insert(i + 10000, i);
+  }
+  scanner.join();
+  EXPECT_EQ(20LL * 9999 * 10000 / 2, sum);
+  EXPECT_TRUE(fid.IsValid());
+  EXPECT_FALSE(fid.Contains(0));
+}
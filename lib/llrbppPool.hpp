@@ -0,0 +1,280 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_POOL_HPP_
+#define LLRBPP_POOL_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace llrbpp{
+
+/**
+ * Node allocators used by LLRBPP.
+ * An allocator hands out raw storage for one T; construction and
+ * destruction of T are done by the caller.
+ *   Allocate()    : return storage for one T
+ *   Deallocate(p) : return storage obtained from Allocate()
+ *   Release()     : drop every storage; storage not passed to
+ *                   Deallocate() is freed only if Exclusive()
+ *   Exclusive()   : true if Release() frees the storage not passed to
+ *                   Deallocate(), since no other allocator shares it
+ *   Share(other)  : keep the storage of other valid while this allocator
+ *                   holds storage, so that nodes can move between trees
+ */
+
+/**
+ * Slab allocator with a free list.
+ * Nodes are carved from contiguous slabs whose size grows geometrically,
+ * and freed nodes are recycled before a slab is extended.
+ * Release() frees the whole pool in O(#slabs).
+ * Slabs belong to a reference-counted arena. Pools that Share storage
+ * use one arena: sharing the storage of another arena merges it into
+ * this one. A pool keeps a free list of its own, and returns it to the
+ * arena on Release(), where every pool of the arena takes slots before
+ * adding a slab; so nodes freed by one pool are reused by the others.
+ * Distinct pools may be used by distinct threads.
+ */
+template <class T>
+class NodePool{
+public:
+  NodePool() : free_head_(NULL), free_tail_(NULL),
+               slab_next_(NULL), slab_end_(NULL), slab_cap_(0){
+  }
+
+  ~NodePool(){
+    Release();
+  }
+
+  T* Allocate(){
+    if (free_head_ == NULL && slab_next_ == slab_end_){
+      Refill();
+    }
+    if (free_head_ != NULL){
+      FreeSlot* slot = free_head_;
+      free_head_ = slot->next;
+      if (free_head_ == NULL) free_tail_ = NULL;
+      return reinterpret_cast<T*>(slot);
+    }
+    T* p = reinterpret_cast<T*>(slab_next_);
+    slab_next_ += sizeof(T);
+    return p;
+  }
+
+  void Deallocate(T* p){
+    FreeSlot* slot = reinterpret_cast<FreeSlot*>(p);
+    slot->next = free_head_;
+    if (free_head_ == NULL) free_tail_ = slot;
+    free_head_ = slot;
+  }
+
+  void Release(){
+    if (arena_ && !Exclusive()){
+      // the rest of the current slab goes to the free list as well
+      for (; slab_next_ != slab_end_; slab_next_ += sizeof(T)){
+        Deallocate(reinterpret_cast<T*>(slab_next_));
+      }
+      if (free_head_ != NULL){
+        std::unique_lock<std::mutex> lock;
+        Arena* arena = LockArena(lock);
+        Splice(arena->free_head, arena->free_tail, free_head_, free_tail_);
+      }
+    }
+    arena_.reset();
+    free_head_ = NULL;
+    free_tail_ = NULL;
+    slab_next_ = NULL;
+    slab_end_ = NULL;
+    slab_cap_ = 0;
+  }
+
+  bool Exclusive(){
+    if (!arena_) return true;
+    std::unique_lock<std::mutex> lock;
+    LockArena(lock);
+    return arena_.use_count() == 1;
+  }
+
+  void Share(const NodePool& other){
+    if (!other.arena_ || arena_ == other.arena_) return;
+    if (!arena_){
+      arena_ = other.arena_;
+      return;
+    }
+    std::shared_ptr<Arena> from = other.arena_;
+    for (;;){
+      {
+        std::unique_lock<std::mutex> lock;
+        LockArena(lock);
+      }
+      {
+        std::unique_lock<std::mutex> lock;
+        from = Resolve(from, lock);
+      }
+      if (from == arena_) return;
+      // lock the two arenas in address order, and retry if either has
+      // been merged meanwhile
+      Arena* first = std::min(arena_.get(), from.get());
+      Arena* second = std::max(arena_.get(), from.get());
+      std::lock_guard<std::mutex> first_lock(first->mutex);
+      std::lock_guard<std::mutex> second_lock(second->mutex);
+      if (arena_->merged_into || from->merged_into) continue;
+      arena_->slabs.insert(arena_->slabs.end(),
+                           from->slabs.begin(), from->slabs.end());
+      from->slabs.clear();
+      Splice(arena_->free_head, arena_->free_tail,
+             from->free_head, from->free_tail);
+      from->free_head = NULL;
+      from->free_tail = NULL;
+      from->merged_into = arena_;
+      return;
+    }
+  }
+
+  size_t SlabNum() const{
+    if (!arena_) return 0;
+    std::unique_lock<std::mutex> lock;
+    return Resolve(arena_, lock)->slabs.size();
+  }
+
+private:
+  struct FreeSlot{
+    FreeSlot* next;
+  };
+
+  struct Arena{
+    Arena() : free_head(NULL), free_tail(NULL){
+    }
+    ~Arena(){
+      for (size_t i = 0; i < slabs.size(); ++i){
+        ::operator delete(slabs[i]);
+      }
+    }
+    std::mutex mutex;
+    std::vector<char*> slabs;
+    FreeSlot* free_head; // slots returned by the pools
+    FreeSlot* free_tail;
+    std::shared_ptr<Arena> merged_into; // set when merged into another
+  };
+
+  static const size_t kMinSlabNodes = 32;
+  static const size_t kMaxSlabNodes = 1 << 16;
+
+  // Append the list [head, tail] to the list [to_head, to_tail].
+  static void Splice(FreeSlot*& to_head, FreeSlot*& to_tail,
+                     FreeSlot* head, FreeSlot* tail){
+    if (head == NULL) return;
+    if (to_tail == NULL){
+      to_head = head;
+    } else {
+      to_tail->next = head;
+    }
+    to_tail = tail;
+  }
+
+  // Follow the merges of arena to the arena now holding its storage,
+  // and return it locked by lock.
+  static std::shared_ptr<Arena> Resolve(std::shared_ptr<Arena> arena,
+                                        std::unique_lock<std::mutex>& lock){
+    for (;;){
+      std::unique_lock<std::mutex> l(arena->mutex);
+      if (!arena->merged_into){
+        lock.swap(l);
+        return arena;
+      }
+      std::shared_ptr<Arena> next = arena->merged_into;
+      l.unlock();
+      arena = next;
+    }
+  }
+
+  // Return the arena of this pool, created if none, locked by lock.
+  Arena* LockArena(std::unique_lock<std::mutex>& lock){
+    if (!arena_){
+      arena_ = std::make_shared<Arena>();
+    }
+    arena_ = Resolve(arena_, lock);
+    return arena_.get();
+  }
+
+  // Take the slots returned to the arena, or start a new slab.
+  void Refill(){
+    std::unique_lock<std::mutex> lock;
+    Arena* arena = LockArena(lock);
+    if (arena->free_head != NULL){
+      free_head_ = arena->free_head;
+      free_tail_ = arena->free_tail;
+      arena->free_head = NULL;
+      arena->free_tail = NULL;
+      return;
+    }
+    size_t cap = (slab_cap_ == 0) ? kMinSlabNodes : slab_cap_ * 2;
+    if (cap > kMaxSlabNodes) cap = kMaxSlabNodes;
+    arena->slabs.reserve(arena->slabs.size() + 1);
+    char* slab = static_cast<char*>(::operator new(sizeof(T) * cap));
+    arena->slabs.push_back(slab);
+    slab_next_ = slab;
+    slab_end_ = slab + sizeof(T) * cap;
+    slab_cap_ = cap;
+  }
+
+  NodePool(const NodePool&);
+  NodePool& operator=(const NodePool&);
+
+  std::shared_ptr<Arena> arena_;
+  FreeSlot* free_head_; // slots freed by this pool
+  FreeSlot* free_tail_;
+  char* slab_next_;     // the unused part of the slab carved now
+  char* slab_end_;
+  size_t slab_cap_;
+};
+
+/**
+ * Allocator calling operator new/delete for each node.
+ */
+template <class T>
+class NewDeleteAllocator{
+public:
+  T* Allocate(){
+    return static_cast<T*>(::operator new(sizeof(T)));
+  }
+
+  void Deallocate(T* p){
+    ::operator delete(p);
+  }
+
+  void Release(){
+  }
+
+  bool Exclusive(){
+    return false;
+  }
+
+  void Share(const NewDeleteAllocator&){
+  }
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_POOL_HPP_
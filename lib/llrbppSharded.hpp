@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_SHARDED_HPP_
+#define LLRBPP_SHARDED_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "llrbpp.hpp"
+
+namespace llrbpp{
+
+/**
+ * Partitions for ShardedLLRBPP. A partition maps a key to its shard:
+ *   size_t operator()(const Key& key, size_t shard_num) const;
+ * returning a value in [0, shard_num).
+ */
+
+// Spread keys by hash; the hash is mixed so that identity hashes of
+// integers spread as well.
+template <class Key, class Hash = std::hash<Key> >
+struct HashPartition{
+  size_t operator()(const Key& key, size_t shard_num) const{
+    uint64_t h = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(((h >> 32) * shard_num) >> 32);
+  }
+};
+
+// Shard i holds the keys in [splitters[i-1], splitters[i]); splitters
+// are sorted and there are shard_num - 1 of them.
+template <class Key, class Comp = std::less<Key> >
+struct RangePartition{
+  RangePartition(){
+  }
+
+  explicit RangePartition(const std::vector<Key>& splitters) :
+    splitters(splitters){
+  }
+
+  size_t operator()(const Key& key, size_t shard_num) const{
+    size_t shard = std::upper_bound(splitters.begin(), splitters.end(),
+                                    key, Comp()) - splitters.begin();
+    return std::min(shard, shard_num - 1);
+  }
+
+  std::vector<Key> splitters;
+};
+
+/**
+ * Map of key to value over shard_num independent LLRBPP trees.
+ * Each key belongs to the shard chosen by Partition, and each shard
+ * has its own reader/writer lock, so operations on different shards
+ * run in parallel and lookups on the same shard share its lock.
+ * ForEachInRange visits all shards in key order by a k-way merge,
+ * holding every shard's read lock so that it sees one consistent state.
+ * All members are thread-safe.
+ */
+template <class Key, class Val, class Comp = std::less<Key>,
+          class Partition = HashPartition<Key> >
+class ShardedLLRBPP{
+public:
+  typedef LLRBPP<Key, Val, Comp> Tree;
+
+  explicit ShardedLLRBPP(size_t shard_num,
+                         const Partition& partition = Partition()) :
+    shards_(CheckShardNum(shard_num)), partition_(partition){
+  }
+
+  void Insert(const Key& key, const Val& val){
+    Shard& shard = ShardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.tree.Insert(key, val);
+  }
+
+  void Delete(const Key& key){
+    Shard& shard = ShardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.tree.Delete(key);
+  }
+
+  // Apply fn(val) to the value of key under the shard's write lock.
+  // Return false if key does not exist.
+  template <class Fn>
+  bool UpdateInPlace(const Key& key, Fn fn){
+    Shard& shard = ShardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.tree.UpdateInPlace(key, fn);
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  std::pair<bool, Val> Find(const Key& key) const{
+    const Shard& shard = ShardOf(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.tree.Find(key);
+  }
+
+  bool Contains(const Key& key) const{
+    const Shard& shard = ShardOf(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.tree.Contains(key);
+  }
+
+  /**
+   * Call fn(key, val) for every key in [lo, hi) in ascending order.
+   * Writers to any shard wait until it returns, so fn must not update
+   * this map.
+   */
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    // locks are taken in shard order; writers hold one lock at a time
+    std::vector<std::shared_lock<std::shared_mutex> > locks;
+    locks.reserve(shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i){
+      locks.push_back(std::shared_lock<std::shared_mutex>(shards_[i].mutex));
+    }
+    std::vector<typename Tree::Iterator> its(shards_.size());
+    auto greater = [&its](size_t a, size_t b){
+      return Comp()(its[b].GetKey(), its[a].GetKey());
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)>
+      heap(greater);
+    for (size_t i = 0; i < shards_.size(); ++i){
+      its[i] = shards_[i].tree.LowerBound(lo);
+      if (InRange(i, its[i], hi)) heap.push(i);
+    }
+    while (!heap.empty()){
+      size_t i = heap.top();
+      heap.pop();
+      fn(its[i].GetKey(), its[i].GetVal());
+      ++its[i];
+      if (InRange(i, its[i], hi)) heap.push(i);
+    }
+  }
+
+  // The number of keys; shards are counted one after another.
+  uint64_t Num() const{
+    uint64_t num = 0;
+    for (size_t i = 0; i < shards_.size(); ++i){
+      std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+      num += shards_[i].tree.Num();
+    }
+    return num;
+  }
+
+  void Clear(){
+    for (size_t i = 0; i < shards_.size(); ++i){
+      std::unique_lock<std::shared_mutex> lock(shards_[i].mutex);
+      shards_[i].tree.Clear();
+    }
+  }
+
+  size_t ShardNum() const{
+    return shards_.size();
+  }
+
+  // Return true iff every shard is valid and holds only its own keys.
+  bool IsValid() const{
+    for (size_t i = 0; i < shards_.size(); ++i){
+      std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+      const Tree& tree = shards_[i].tree;
+      if (!tree.IsValid()) return false;
+      for (typename Tree::Iterator it = tree.Begin(); it != tree.End(); ++it){
+        if (partition_(it.GetKey(), shards_.size()) != i) return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  // Shards sit on their own cache lines, so that taking one lock does
+  // not invalidate the line of another.
+  struct alignas(64) Shard{
+    mutable std::shared_mutex mutex;
+    Tree tree;
+  };
+
+  static size_t CheckShardNum(size_t shard_num){
+    if (shard_num == 0){
+      throw std::invalid_argument("ShardedLLRBPP: shard_num must be positive");
+    }
+    return shard_num;
+  }
+
+  Shard& ShardOf(const Key& key){
+    return shards_[partition_(key, shards_.size())];
+  }
+
+  const Shard& ShardOf(const Key& key) const{
+    return shards_[partition_(key, shards_.size())];
+  }
+
+  bool InRange(size_t shard, const typename Tree::Iterator& it,
+               const Key& hi) const{
+    return it != shards_[shard].tree.End() && Comp()(it.GetKey(), hi);
+  }
+
+  ShardedLLRBPP(const ShardedLLRBPP&);
+  ShardedLLRBPP& operator=(const ShardedLLRBPP&);
+
+  std::vector<Shard> shards_;
+  Partition partition_;
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_SHARDED_HPP_
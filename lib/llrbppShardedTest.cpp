@@ -0,0 +1,116 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "llrbppSharded.hpp"
+
+using namespace std;
+
+namespace {
+
+template <class Tree>
+void RandomSharded(Tree& fid){
+  map<int, int> m;
+  for (int i = 0; i < 20000; ++i){
+    int key = rand() % 3000;
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (int key = 0; key < 3000; ++key){
+    pair<bool, int> ret = fid.Find(key);
+    ASSERT_EQ(m.count(key) > 0, ret.first);
+    if (ret.first){
+      EXPECT_EQ(m[key], ret.second);
+    }
+  }
+  typedef vector<pair<int, int> > KVs;
+  KVs kvs;
+  fid.ForEachInRange(500, 2500, [&kvs](int key, int val){
+      kvs.push_back(make_pair(key, val));
+    });
+  EXPECT_EQ(KVs(m.lower_bound(500), m.lower_bound(2500)), kvs);
+}
+
+}
+
+TEST(ShardedLLRBPP, hash){
+  llrbpp::ShardedLLRBPP<int, int> fid(8);
+  EXPECT_EQ(8U, fid.ShardNum());
+  RandomSharded(fid);
+  EXPECT_TRUE(fid.UpdateInPlace(7, [](int& val){ val = -7; }) ==
+              fid.Contains(7));
+  fid.Clear();
+  EXPECT_EQ(0U, fid.Num());
+  typedef llrbpp::ShardedLLRBPP<int, int> Sharded;
+  EXPECT_THROW(Sharded(0), invalid_argument);
+}
+
+TEST(ShardedLLRBPP, range){
+  vector<int> splitters;
+  splitters.push_back(1000);
+  splitters.push_back(2000);
+  typedef llrbpp::RangePartition<int> Partition;
+  llrbpp::ShardedLLRBPP<int, int, less<int>, Partition> fid(3, Partition(splitters));
+  RandomSharded(fid);
+  llrbpp::ShardedLLRBPP<int, int> one(1);
+  RandomSharded(one);
+}
+
+TEST(ShardedLLRBPP, threads){
+  llrbpp::ShardedLLRBPP<string, int> fid(16);
+  const int kThreads = 8;
+  const int kKeys = 2000;
+  vector<thread> threads;
+  for (int t = 0; t < kThreads; ++t){
+    threads.push_back(thread([&fid, t](){
+          for (int i = 0; i < kKeys; ++i){
+            fid.Insert(to_string(i * kThreads + t), i);
+            if (i % 2 == 1) fid.Delete(to_string((i - 1) * kThreads + t));
+            fid.Contains(to_string(i));
+          }
+        }));
+  }
+  int visits = 0;
+  fid.ForEachInRange("", "~", [&visits](const string&, int){
+      ++visits;
+    });
+  for (int t = 0; t < kThreads; ++t){
+    threads[t].join();
+  }
+  EXPECT_TRUE(fid.IsValid());
+  EXPECT_EQ(static_cast<uint64_t>(kThreads * kKeys / 2), fid.Num());
+  string prev;
+  fid.ForEachInRange("", "~", [&prev](const string& key, int val){
+      EXPECT_LT(prev, key);
+      EXPECT_EQ(1, val % 2);
+      prev = key;
+    });
+}
@@ -19,9 +19,15 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <string_view>
 #include <queue>
 #include <map>
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include "llrbpp.hpp"
+#include "llrbppFile.hpp"
+#include "llrbppFrozen.hpp"
 
 using namespace std;
 
@@ -75,3 +81,814 @@ TEST(llrbpp, small){
 
 
 
+
+template <class Tree>
+void RandomInsertDelete(Tree& tree, int N, int key_range){
+  map<int, int> m;
+  for (int i = 0; i < N; ++i){
+    int key = rand() % key_range;
+    if (rand() % 3 == 0){
+      tree.Delete(key);
+      m.erase(key);
+    } else {
+      int val = rand();
+      tree.Insert(key, val);
+      m[key] = val;
+    }
+  }
+  ASSERT_EQ(m.size(), tree.Num());
+  ASSERT_TRUE(tree.IsValid());
+  for (int key = 0; key < key_range; ++key){
+    map<int, int>::const_iterator it = m.find(key);
+    if (it == m.end()){
+      EXPECT_EQ(make_pair(false, int()), tree.Find(key));
+    } else {
+      EXPECT_EQ(make_pair(true, it->second), tree.Find(key));
+    }
+  }
+}
+
+TEST(llrbpp, churn){
+  llrbpp::LLRBPP<int, int> fid;
+  RandomInsertDelete(fid, 100000, 1000);
+  fid.Clear();
+  EXPECT_EQ(0, fid.Num());
+  RandomInsertDelete(fid, 100000, 100000);
+}
+
+TEST(llrbpp, newdelete){
+  llrbpp::LLRBPP<int, int, less<int>, llrbpp::NewDeleteAllocator> fid;
+  RandomInsertDelete(fid, 100000, 1000);
+}
+
+TEST(llrbpp, stringchurn){
+  llrbpp::LLRBPP<string, string> fid;
+  map<string, string> m;
+  for (int i = 0; i < 10000; ++i){
+    string key(40, 'a' + rand() % 26);
+    key[0] = 'a' + rand() % 26;
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, key + key);
+      m[key] = key + key;
+    }
+  }
+  ASSERT_EQ(m.size(), fid.Num());
+  ASSERT_TRUE(fid.IsValid());
+  for (map<string, string>::const_iterator it = m.begin(); it != m.end(); ++it){
+    EXPECT_EQ(make_pair(true, it->second), fid.Find(it->first));
+  }
+}
+
+TEST(llrbpp, pool){
+  llrbpp::NodePool<llrbpp::Node<int, int> > pool;
+  EXPECT_EQ(0, pool.SlabNum());
+  llrbpp::Node<int, int>* a = pool.Allocate();
+  llrbpp::Node<int, int>* b = pool.Allocate();
+  EXPECT_EQ(a + 1, b);
+  pool.Deallocate(a);
+  EXPECT_EQ(a, pool.Allocate());
+  EXPECT_EQ(1, pool.SlabNum());
+  pool.Release();
+  EXPECT_EQ(0, pool.SlabNum());
+}
+
+struct CollectVisitor{
+  explicit CollectVisitor(vector<pair<int, int> >& out) : out(out) {}
+  void operator()(const int& key, const int& val){
+    out.push_back(make_pair(key, val));
+  }
+  vector<pair<int, int> >& out;
+};
+
+TEST(llrbpp, iterator){
+  llrbpp::LLRBPP<int, int> fid;
+  EXPECT_TRUE(fid.Begin() == fid.End());
+  map<int, int> m;
+  for (int i = 0; i < 1000; ++i){
+    int key = rand() % 3000;
+    fid.Insert(key, i);
+    m[key] = i;
+  }
+
+  llrbpp::LLRBPP<int, int>::Iterator it = fid.Begin();
+  for (map<int, int>::const_iterator mit = m.begin(); mit != m.end(); ++mit){
+    ASSERT_TRUE(it != fid.End());
+    EXPECT_EQ(mit->first, it.GetKey());
+    EXPECT_EQ(mit->second, it.GetVal());
+    ++it;
+  }
+  EXPECT_TRUE(it == fid.End());
+
+  for (map<int, int>::const_reverse_iterator mit = m.rbegin(); mit != m.rend(); ++mit){
+    --it;
+    EXPECT_EQ(mit->first, it.GetKey());
+  }
+  EXPECT_TRUE(it == fid.Begin());
+}
+
+TEST(llrbpp, bound){
+  llrbpp::LLRBPP<int, int> fid;
+  map<int, int> m;
+  for (int i = 0; i < 1000; ++i){
+    int key = rand() % 3000;
+    fid.Insert(key, i);
+    m[key] = i;
+  }
+  for (int key = -1; key <= 3001; ++key){
+    map<int, int>::const_iterator lit = m.lower_bound(key);
+    llrbpp::LLRBPP<int, int>::Iterator it = fid.LowerBound(key);
+    if (lit == m.end()){
+      EXPECT_TRUE(it == fid.End());
+    } else {
+      ASSERT_TRUE(it != fid.End());
+      EXPECT_EQ(lit->first, it.GetKey());
+    }
+    map<int, int>::const_iterator uit = m.upper_bound(key);
+    it = fid.UpperBound(key);
+    if (uit == m.end()){
+      EXPECT_TRUE(it == fid.End());
+    } else {
+      ASSERT_TRUE(it != fid.End());
+      EXPECT_EQ(uit->first, it.GetKey());
+    }
+  }
+}
+
+TEST(llrbpp, range){
+  llrbpp::LLRBPP<int, int> fid;
+  map<int, int> m;
+  for (int i = 0; i < 1000; ++i){
+    int key = rand() % 3000;
+    fid.Insert(key, i);
+    m[key] = i;
+  }
+  for (int i = 0; i < 100; ++i){
+    int lo = rand() % 3000;
+    int hi = lo + rand() % 500;
+    vector<pair<int, int> > out;
+    fid.ForEachInRange(lo, hi, CollectVisitor(out));
+    vector<pair<int, int> > expected(m.lower_bound(lo), m.lower_bound(hi));
+    EXPECT_EQ(expected, out);
+  }
+}
+
+TEST(llrbpp, rank){
+  typedef llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+                         llrbpp::SizeAugment> RankTree;
+  RankTree fid;
+  RandomInsertDelete(fid, 20000, 2000);
+  vector<int> keys;
+  for (RankTree::Iterator it = fid.Begin(); it != fid.End(); ++it){
+    keys.push_back(it.GetKey());
+  }
+  ASSERT_EQ(keys.size(), fid.Num());
+  for (int key = -1; key <= 2001; ++key){
+    uint64_t rank = lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    EXPECT_EQ(rank, fid.Rank(key));
+  }
+  for (uint64_t k = 0; k < keys.size(); ++k){
+    RankTree::Iterator it = fid.Select(k);
+    ASSERT_TRUE(it != fid.End());
+    EXPECT_EQ(keys[k], it.GetKey());
+    ++it;
+    if (k + 1 < keys.size()){
+      EXPECT_EQ(keys[k+1], it.GetKey());
+    }
+  }
+  EXPECT_TRUE(fid.Select(keys.size()) == fid.End());
+  EXPECT_EQ(fid.Num(), fid.CountInRange(-1, 2001));
+  EXPECT_EQ(0, fid.CountInRange(100, 100));
+  uint64_t expected = lower_bound(keys.begin(), keys.end(), 1500) 
+    - lower_bound(keys.begin(), keys.end(), 500);
+  EXPECT_EQ(expected, fid.CountInRange(500, 1500));
+}
+
+TEST(llrbpp, nocost){
+  struct PlainNode{
+    int key;
+    int val;
+    void* left;
+    void* right;
+    bool color;
+  };
+  EXPECT_EQ(sizeof(PlainNode), sizeof(llrbpp::Node<int, int>));
+}
+
+struct ConcatMonoid{
+  typedef string Value;
+  static string Identity(){
+    return string();
+  }
+  static string Combine(const string& x, const string& y){
+    return x + y;
+  }
+  static string Lift(const int&, const char& val){
+    return string(1, val);
+  }
+};
+
+TEST(llrbpp, aggregate){
+  typedef llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+    llrbpp::MonoidAugment<llrbpp::SumMonoid<int64_t> > > SumTree;
+  typedef llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+    llrbpp::MonoidAugment<llrbpp::MinMonoid<int> > > MinTree;
+  SumTree sum_tree;
+  MinTree min_tree;
+  map<int, int> m;
+  for (int i = 0; i < 20000; ++i){
+    int key = rand() % 1000;
+    if (rand() % 3 == 0){
+      sum_tree.Delete(key);
+      min_tree.Delete(key);
+      m.erase(key);
+    } else {
+      int val = rand() % 10000;
+      sum_tree.Insert(key, val);
+      min_tree.Insert(key, val);
+      m[key] = val;
+    }
+  }
+  ASSERT_TRUE(sum_tree.IsValid());
+  vector<int> vals;
+  for (map<int, int>::const_iterator it = m.begin(); it != m.end(); ++it){
+    vals.push_back(it->second);
+  }
+  for (int i = 0; i < 1000; ++i){
+    int lo = rand() % 1100 - 50;
+    int hi = lo + rand() % 300;
+    int64_t sum = 0;
+    int min_val = numeric_limits<int>::max();
+    for (map<int, int>::const_iterator it = m.lower_bound(lo); 
+         it != m.lower_bound(hi); ++it){
+      sum += it->second;
+      min_val = min(min_val, it->second);
+    }
+    EXPECT_EQ(sum, sum_tree.Aggregate(lo, hi));
+    EXPECT_EQ(min_val, min_tree.Aggregate(lo, hi));
+
+    uint64_t begin = rand() % (vals.size() + 10);
+    uint64_t end = begin + rand() % 300;
+    sum = 0;
+    min_val = numeric_limits<int>::max();
+    for (uint64_t j = begin; j < end && j < vals.size(); ++j){
+      sum += vals[j];
+      min_val = min(min_val, vals[j]);
+    }
+    EXPECT_EQ(sum, sum_tree.AggregateByPosition(begin, end));
+    EXPECT_EQ(min_val, min_tree.AggregateByPosition(begin, end));
+  }
+}
+
+TEST(llrbpp, aggregateorder){
+  llrbpp::LLRBPP<int, char, less<int>, llrbpp::NodePool,
+    llrbpp::MonoidAugment<ConcatMonoid> > fid;
+  string all = "abcdefghijklmnopqrstuvwxyz";
+  for (int i = 0; i < 26; ++i){
+    int key = (i * 7) % 26;
+    fid.Insert(key, all[key]);
+  }
+  for (int lo = 0; lo <= 26; ++lo){
+    for (int hi = lo; hi <= 26; ++hi){
+      EXPECT_EQ(all.substr(lo, hi - lo), fid.Aggregate(lo, hi));
+      EXPECT_EQ(all.substr(lo, hi - lo), fid.AggregateByPosition(lo, hi));
+    }
+  }
+  fid.Insert(3, 'D');
+  EXPECT_EQ("abcDe", fid.Aggregate(0, 5));
+}
+
+TEST(llrbpp, buildfromsorted){
+  for (int num = 0; num < 300; ++num){
+    vector<pair<int, int> > kvs;
+    for (int i = 0; i < num; ++i){
+      kvs.push_back(make_pair(i * 2, i));
+    }
+    llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+                   llrbpp::SizeAugment> fid;
+    fid.Insert(-1, -1);
+    fid.BuildFromSorted(kvs.begin(), kvs.end());
+    ASSERT_EQ(num, fid.Num());
+    ASSERT_TRUE(fid.IsValid()) << " num=" << num;
+    for (int i = 0; i < num; ++i){
+      EXPECT_EQ(make_pair(true, i), fid.Find(i * 2));
+      EXPECT_EQ(i, fid.Rank(i * 2));
+    }
+    EXPECT_EQ(make_pair(false, 0), fid.Find(-1));
+    for (int i = 0; i < num; i += 3){
+      fid.Delete(i * 2);
+    }
+    fid.Insert(1, 1);
+    ASSERT_TRUE(fid.IsValid()) << " num=" << num;
+  }
+}
+
+TEST(llrbpp, batch){
+  typedef llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+                         llrbpp::SizeAugment> RankTree;
+  for (int round = 0; round < 3; ++round){
+    RankTree fid;
+    map<int, int> m;
+    if (round == 2){
+      // batches much smaller than the tree
+      for (int i = 0; i < 20000; i += 2){
+        fid.Insert(i, i);
+        m[i] = i;
+      }
+    }
+    for (int i = 0; i < 200; ++i){
+      int batch_num = (round == 1) ? rand() % 500 : rand() % 8;
+      if (round == 2) batch_num = rand() % 200;
+      map<int, int> batch;
+      for (int j = 0; j < batch_num; ++j){
+        batch[rand() % 20000] = rand();
+      }
+      if (rand() % 3 == 0){
+        vector<int> keys;
+        for (map<int, int>::const_iterator it = batch.begin(); it != batch.end(); ++it){
+          keys.push_back(it->first);
+          m.erase(it->first);
+        }
+        fid.DeleteBatch(keys.begin(), keys.end());
+      } else {
+        fid.InsertBatch(batch.begin(), batch.end());
+        for (map<int, int>::const_iterator it = batch.begin(); it != batch.end(); ++it){
+          m[it->first] = it->second;
+        }
+      }
+      ASSERT_EQ(m.size(), fid.Num());
+      ASSERT_TRUE(fid.IsValid());
+    }
+    RankTree::Iterator it = fid.Begin();
+    uint64_t rank = 0;
+    for (map<int, int>::const_iterator mit = m.begin(); mit != m.end(); ++mit, ++it){
+      ASSERT_TRUE(it != fid.End());
+      EXPECT_EQ(mit->first, it.GetKey());
+      EXPECT_EQ(mit->second, it.GetVal());
+      EXPECT_EQ(rank++, fid.Rank(mit->first));
+    }
+    EXPECT_TRUE(it == fid.End());
+  }
+}
+
+template <class Tree>
+void CheckContents(const Tree& fid, map<int, int>::const_iterator begin,
+                   map<int, int>::const_iterator end){
+  typename Tree::Iterator it = fid.Begin();
+  for (; begin != end; ++begin, ++it){
+    ASSERT_TRUE(it != fid.End());
+    EXPECT_EQ(begin->first, it.GetKey());
+    EXPECT_EQ(begin->second, it.GetVal());
+  }
+  EXPECT_TRUE(it == fid.End());
+}
+
+TEST(llrbpp, splitjoin){
+  typedef llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+                         llrbpp::SizeAugment> RankTree;
+  typedef llrbpp::LLRBPP<int, int> Tree;
+  for (int round = 0; round < 50; ++round){
+    map<int, int> m;
+    int num = rand() % 1000;
+    RankTree rank_fid;
+    Tree fid;
+    for (int i = 0; i < num; ++i){
+      int key = rand() % 2000;
+      rank_fid.Insert(key, i);
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+    int key = rand() % 2100 - 50;
+    map<int, int>::const_iterator mid = m.lower_bound(key);
+
+    RankTree rank_upper;
+    rank_upper.Insert(-1, -1);
+    rank_fid.Split(key, rank_upper);
+    ASSERT_TRUE(rank_fid.IsValid());
+    ASSERT_TRUE(rank_upper.IsValid());
+    CheckContents(rank_fid, m.begin(), mid);
+    CheckContents(rank_upper, mid, m.end());
+    EXPECT_EQ(0, rank_upper.Rank(key));
+
+    Tree upper;
+    fid.Split(key, upper);
+    ASSERT_TRUE(fid.IsValid());
+    ASSERT_TRUE(upper.IsValid());
+    CheckContents(fid, m.begin(), mid);
+    CheckContents(upper, mid, m.end());
+
+    // the nodes of upper outlive the tree they were split from
+    fid.Clear();
+    upper.Insert(5000, 0);
+    upper.Delete(5000);
+    CheckContents(upper, mid, m.end());
+
+    rank_fid.Join(rank_upper);
+    EXPECT_EQ(0, rank_upper.Num());
+    ASSERT_TRUE(rank_fid.IsValid());
+    CheckContents(rank_fid, m.begin(), m.end());
+    rank_fid.Insert(-2, 0);
+    rank_fid.Delete(-2);
+    ASSERT_TRUE(rank_fid.IsValid());
+  }
+}
+
+TEST(llrbpp, splitjoinrepeat){
+  // repeated split/join reuses the storage instead of accumulating it
+  llrbpp::LLRBPP<int, int> fid;
+  for (int i = 0; i < 20000; ++i){
+    fid.Insert(i, i);
+  }
+  size_t slab_num = 0;
+  for (int round = 0; round < 3000; ++round){
+    llrbpp::LLRBPP<int, int> upper;
+    fid.Split(19990, upper);
+    upper.Insert(30000, 0);
+    upper.Delete(30000);
+    fid.Join(upper);
+    // the slots freed by upper come back to fid
+    fid.Delete(round % 100);
+    fid.Insert(round % 100, 0);
+    if (round == 10){
+      slab_num = fid.GetAllocator().SlabNum();
+    }
+  }
+  EXPECT_EQ(20000, fid.Num());
+  ASSERT_TRUE(fid.IsValid());
+  EXPECT_EQ(slab_num, fid.GetAllocator().SlabNum());
+}
+
+TEST(llrbpp, joinskewed){
+  // join trees of very different black heights
+  for (int small = 0; small < 40; ++small){
+    llrbpp::LLRBPP<int, int, less<int>, llrbpp::NewDeleteAllocator> lower, upper;
+    map<int, int> m;
+    for (int i = 0; i < small; ++i){
+      lower.Insert(i, i);
+      m[i] = i;
+    }
+    for (int i = 0; i < 3000; ++i){
+      upper.Insert(1000 + i, i);
+      m[1000 + i] = i;
+    }
+    if (small > 0){
+      EXPECT_THROW(upper.Join(lower), invalid_argument);
+    }
+    EXPECT_EQ(small, lower.Num());
+    EXPECT_EQ(3000, upper.Num());
+    lower.Join(upper);
+    EXPECT_EQ(0, upper.Num());
+    ASSERT_TRUE(lower.IsValid());
+    CheckContents(lower, m.begin(), m.end());
+  }
+}
+
+struct CopyCounter{
+  static int copies;
+  explicit CopyCounter(int v = 0) : v(v){
+  }
+  CopyCounter(const CopyCounter& c) : v(c.v){
+    ++copies;
+  }
+  CopyCounter(CopyCounter&&) = default;
+  CopyCounter& operator=(const CopyCounter& c){
+    v = c.v;
+    ++copies;
+    return *this;
+  }
+  CopyCounter& operator=(CopyCounter&&) = default;
+  int v;
+};
+
+int CopyCounter::copies = 0;
+
+TEST(llrbpp, nocopy){
+  llrbpp::LLRBPP<int, CopyCounter> fid;
+  CopyCounter::copies = 0;
+  for (int i = 0; i < 1000; ++i){
+    EXPECT_TRUE(fid.TryEmplace(i * 7 % 1000, i));
+  }
+  EXPECT_FALSE(fid.TryEmplace(3, -1));
+  EXPECT_FALSE(fid.Emplace(3, -1));
+  EXPECT_TRUE(fid.Emplace(1000, 1000));
+  fid.Insert(5, CopyCounter(-5));
+  for (int i = 0; i < 1000; i += 2){
+    fid.Delete(i);
+    ASSERT_TRUE(fid.IsValid());
+  }
+  EXPECT_EQ(0, CopyCounter::copies);
+  EXPECT_EQ(501, fid.Num());
+  EXPECT_EQ(-5, fid.LowerBound(5).GetVal().v);
+  EXPECT_EQ(3 * 143, fid.LowerBound(3).GetVal().v);
+}
+
+TEST(llrbpp, moveonly){
+  llrbpp::LLRBPP<string, unique_ptr<int> > fid;
+  for (int i = 0; i < 100; ++i){
+    string key = to_string(i);
+    if (i % 2 == 0){
+      fid.Insert(move(key), unique_ptr<int>(new int(i)));
+    } else {
+      fid.Emplace(key, new int(i));
+    }
+  }
+  fid.Insert(string("7"), unique_ptr<int>(new int(-7)));
+  for (int i = 0; i < 100; i += 3){
+    fid.Delete(to_string(i));
+  }
+  ASSERT_TRUE(fid.IsValid());
+  EXPECT_EQ(66, fid.Num());
+  for (llrbpp::LLRBPP<string, unique_ptr<int> >::Iterator it = fid.Begin();
+       it != fid.End(); ++it){
+    int i = atoi(it.GetKey().c_str());
+    EXPECT_NE(0, i % 3);
+    EXPECT_EQ((i == 7) ? -7 : i, *it.GetVal());
+  }
+}
+
+TEST(llrbpp, findptr){
+  llrbpp::LLRBPP<string, int> fid;
+  fid.Insert("aaa", 1);
+  fid.Insert("bbb", 2);
+  ASSERT_TRUE(fid.FindPtr("aaa") != NULL);
+  EXPECT_EQ(1, *fid.FindPtr("aaa"));
+  EXPECT_TRUE(fid.FindPtr("aab") == NULL);
+  EXPECT_TRUE(fid.Contains("bbb"));
+  EXPECT_FALSE(fid.Contains(""));
+  EXPECT_TRUE(fid.UpdateInPlace("bbb", [](int& val){ val += 10; }));
+  EXPECT_FALSE(fid.UpdateInPlace("ccc", [](int& val){ val += 10; }));
+  EXPECT_EQ(12, *fid.FindPtr("bbb"));
+
+  // heterogeneous lookup with a transparent comparator
+  llrbpp::LLRBPP<string, int, less<> > hfid;
+  for (int i = 0; i < 100; ++i){
+    hfid.Insert(to_string(i), i);
+  }
+  string probe = "42";
+  string_view view(probe);
+  ASSERT_TRUE(hfid.FindPtr(view) != NULL);
+  EXPECT_EQ(42, *hfid.FindPtr(view));
+  EXPECT_FALSE(hfid.Contains(string_view("420")));
+  EXPECT_TRUE(hfid.UpdateInPlace(view, [](int& val){ val = -1; }));
+  EXPECT_EQ(-1, *hfid.FindPtr(probe));
+}
+
+TEST(llrbpp, updateinplace){
+  llrbpp::LLRBPP<int, int, less<int>, llrbpp::NodePool,
+                 llrbpp::MonoidAugment<llrbpp::SumMonoid<int64_t> > > fid;
+  map<int, int> m;
+  for (int i = 0; i < 1000; ++i){
+    int key = rand() % 3000;
+    fid.Insert(key, i);
+    m[key] = i;
+  }
+  for (int i = 0; i < 1000; ++i){
+    int key = rand() % 3000;
+    bool found = m.find(key) != m.end();
+    EXPECT_EQ(found, fid.UpdateInPlace(key, [i](int& val){ val = i; }));
+    if (found) m[key] = i;
+  }
+  int64_t sum = 0;
+  for (map<int, int>::const_iterator it = m.begin(); it != m.end(); ++it){
+    if (it->first >= 1000 && it->first < 2000) sum += it->second;
+  }
+  EXPECT_EQ(sum, fid.Aggregate(1000, 2000));
+  ASSERT_TRUE(fid.IsValid());
+}
+
+// a key ordered by operator< only
+struct NoEqualKey{
+  explicit NoEqualKey(int v) : v(v){
+  }
+  bool operator<(const NoEqualKey& k) const{
+    return v < k.v;
+  }
+  int v;
+};
+
+TEST(llrbpp, compareonly){
+  llrbpp::LLRBPP<NoEqualKey, int> fid;
+  map<int, int> m;
+  for (int i = 0; i < 3000; ++i){
+    int key = rand() % 1000;
+    if (rand() % 3 == 0){
+      fid.Delete(NoEqualKey(key));
+      m.erase(key);
+    } else {
+      fid.Insert(NoEqualKey(key), i);
+      m[key] = i;
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (int key = 0; key < 1000; ++key){
+    const int* val = fid.FindPtr(NoEqualKey(key));
+    ASSERT_EQ(m.count(key) > 0, val != NULL);
+    if (val != NULL){
+      EXPECT_EQ(m[key], *val);
+    }
+  }
+}
+
+// orders NoEqualKey and counts the calls
+struct CountingLess{
+  bool operator()(const NoEqualKey& a, const NoEqualKey& b) const{
+    ++count;
+    return a.v < b.v;
+  }
+  static int count;
+};
+int CountingLess::count = 0;
+
+TEST(llrbpp, deletecomparecount){
+  llrbpp::LLRBPP<NoEqualKey, int, CountingLess> fid;
+  for (int i = 0; i < 4096; ++i){
+    fid.Insert(NoEqualKey(i), i);
+  }
+  for (int i = 0; i < 4096; i += 3){
+    fid.Delete(NoEqualKey(i));
+    // a key beyond the maximum costs one Comp call per level
+    int depth = fid.DepthMax();
+    CountingLess::count = 0;
+    fid.Delete(NoEqualKey(4096));
+    EXPECT_LE(CountingLess::count, depth + 2);
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(4096 - 1366, fid.Num());
+  for (int i = 0; i < 4096; ++i){
+    EXPECT_EQ(i % 3 != 0, fid.Contains(NoEqualKey(i))) << " key=" << i;
+  }
+}
+
+TEST(llrbpp, stringcompare){
+  llrbpp::LLRBPP<string, int, llrbpp::StringCompare> fid;
+  map<string, int> m;
+  for (int i = 0; i < 3000; ++i){
+    string key = to_string(rand() % 1000);
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (map<string, int>::const_iterator it = m.begin(); it != m.end(); ++it){
+    EXPECT_EQ(make_pair(true, it->second), fid.Find(it->first));
+    EXPECT_TRUE(fid.Contains(string_view(it->first)));
+  }
+  EXPECT_FALSE(fid.Contains("-1"));
+}
+
+TEST(llrbpp, freeze){
+  // every small size covers every shape of the last level
+  for (int num = 0; num < 70; ++num){
+    llrbpp::LLRBPP<int, int> fid;
+    for (int i = 0; i < num; ++i){
+      fid.Insert(2 * i + 1, i);
+    }
+    llrbpp::FrozenLLRBPP<int, int> frozen = llrbpp::Freeze(fid);
+    ASSERT_EQ(static_cast<uint64_t>(num), frozen.Num());
+    for (int key = 0; key <= 2 * num + 1; ++key){
+      const int* val = frozen.FindPtr(key);
+      ASSERT_EQ(key % 2 == 1 && key < 2 * num, val != NULL);
+      if (val != NULL){
+        EXPECT_EQ(key / 2, *val);
+      }
+    }
+    vector<int> keys;
+    frozen.ForEachInRange(4, 2 * num - 2, [&keys](int key, int){
+        keys.push_back(key);
+      });
+    for (size_t i = 0; i < keys.size(); ++i){
+      EXPECT_EQ(static_cast<int>(2 * i + 5), keys[i]);
+    }
+    EXPECT_EQ(static_cast<size_t>(max(num - 3, 0)), keys.size());
+  }
+
+  // the snapshot is unaffected by later updates
+  llrbpp::LLRBPP<string, int> fid;
+  map<string, int> m;
+  for (int i = 0; i < 1000; ++i){
+    string key = to_string(rand() % 3000);
+    fid.Insert(key, i);
+    m[key] = i;
+  }
+  llrbpp::FrozenLLRBPP<string, int> frozen = llrbpp::Freeze(fid);
+  fid.Clear();
+  fid.Insert("-1", -1);
+  for (int key = -1; key < 3000; ++key){
+    map<string, int>::const_iterator it = m.find(to_string(key));
+    pair<bool, int> ret = frozen.Find(to_string(key));
+    ASSERT_EQ(it != m.end(), ret.first);
+    if (ret.first){
+      EXPECT_EQ(it->second, ret.second);
+    }
+  }
+}
+
+TEST(llrbpp, findbatch){
+  llrbpp::LLRBPP<int, int> fid;
+  map<int, int> m;
+  for (int i = 0; i < 3000; ++i){
+    int key = rand() % 10000;
+    fid.Insert(key, i);
+    m[key] = i;
+  }
+  // sizes around the group size, and a batch against an empty tree
+  for (size_t n = 0; n < 100; n += 7){
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i){
+      keys[i] = rand() % 10000;
+    }
+    int sentinel = 0;
+    vector<const int*> out(n + 1, &sentinel);
+    fid.FindBatch(keys.data(), n, out.data());
+    for (size_t i = 0; i < n; ++i){
+      map<int, int>::const_iterator it = m.find(keys[i]);
+      if (it == m.end()){
+        EXPECT_TRUE(out[i] == NULL) << " key=" << keys[i];
+      } else {
+        ASSERT_TRUE(out[i] != NULL) << " key=" << keys[i];
+        EXPECT_EQ(it->second, *out[i]);
+      }
+    }
+    EXPECT_EQ(&sentinel, out[n]);
+  }
+  llrbpp::LLRBPP<int, int> empty;
+  int key = 1;
+  const int* out = &key;
+  empty.FindBatch(&key, 1, &out);
+  EXPECT_TRUE(out == NULL);
+}
+
+TEST(llrbpp, saveload){
+  string path = "/tmp/llrbpp_saveload.img";
+  for (int num = 0; num <= 3000; num += 1500){
+    llrbpp::LLRBPP<uint64_t, double> fid;
+    map<uint64_t, double> m;
+    for (int i = 0; i < num; ++i){
+      uint64_t key = (static_cast<uint64_t>(rand()) << 20) ^ rand();
+      fid.Insert(key, i * 0.5);
+      m[key] = i * 0.5;
+    }
+    llrbpp::SaveImage(fid, path);
+
+    llrbpp::LLRBPP<uint64_t, double> loaded;
+    loaded.Insert(1, 1.0);
+    llrbpp::LoadImage(loaded, path);
+    ASSERT_TRUE(loaded.IsValid());
+    ASSERT_EQ(m.size(), loaded.Num());
+    llrbpp::MappedLLRBPP<uint64_t, double> mapped(path);
+    ASSERT_EQ(m.size(), mapped.Num());
+    for (map<uint64_t, double>::const_iterator it = m.begin(); it != m.end(); ++it){
+      EXPECT_EQ(make_pair(true, it->second), loaded.Find(it->first));
+      ASSERT_TRUE(mapped.FindPtr(it->first) != NULL);
+      EXPECT_EQ(it->second, *mapped.FindPtr(it->first));
+      EXPECT_FALSE(mapped.Contains(it->first + 1) && m.count(it->first + 1) == 0);
+    }
+    EXPECT_FALSE(mapped.Contains(0));
+    vector<uint64_t> keys;
+    mapped.ForEachInRange(1ULL << 40, 1ULL << 45, [&keys](uint64_t key, double){
+        keys.push_back(key);
+      });
+    EXPECT_EQ(static_cast<ptrdiff_t>(keys.size()),
+              distance(m.lower_bound(1ULL << 40), m.lower_bound(1ULL << 45)));
+  }
+
+  // an image of other types, a corrupted image and a missing file
+  typedef llrbpp::LLRBPP<uint32_t, double> OtherTree;
+  OtherTree other;
+  EXPECT_THROW(llrbpp::LoadImage(other, path), runtime_error);
+  FILE* fp = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(fp != NULL);
+  fseek(fp, 100, SEEK_SET);
+  fputc(0x5a, fp);
+  fclose(fp);
+  llrbpp::LLRBPP<uint64_t, double> fid;
+  EXPECT_THROW(llrbpp::LoadImage(fid, path), runtime_error);
+  typedef llrbpp::MappedLLRBPP<uint64_t, double> Mapped;
+  EXPECT_NO_THROW(Mapped(path, false));
+  remove(path.c_str());
+  EXPECT_THROW(llrbpp::LoadImage(fid, path), runtime_error);
+  EXPECT_THROW(Mapped(path, false), runtime_error);
+
+  // an empty file and one shorter than the header are not mapped
+  fid.Insert(1, 1.0);
+  for (int size = 0; size <= 10; size += 10){
+    fp = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(fp != NULL);
+    for (int i = 0; i < size; ++i){
+      fputc(0, fp);
+    }
+    fclose(fp);
+    EXPECT_THROW(Mapped(path, false), runtime_error);
+    EXPECT_THROW(llrbpp::LoadImage(fid, path), runtime_error);
+    EXPECT_EQ(make_pair(true, 1.0), fid.Find(1));
+  }
+  remove(path.c_str());
+}
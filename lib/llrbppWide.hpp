@@ -0,0 +1,566 @@
+/*
+ *  Copyright (c) 2012 Daisuke Okanohara
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef LLRBPP_WIDE_HPP_
+#define LLRBPP_WIDE_HPP_
+
+#include <stdint.h>
+#include <stdio.h> // NULL
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LLRBPP_WIDE_X86 1
+#endif
+
+namespace llrbpp{
+
+#ifdef LLRBPP_WIDE_X86
+
+// Bit i of the masks below is set iff keys[i] < key (Less) or
+// keys[i] > key (Greater) for i < num. Keys are compared as signed
+// integers after xor with bias, which flips the sign bit of unsigned
+// keys. keys must be readable up to num rounded up to the vector width.
+
+inline bool WideHasAVX2(){
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+inline uint64_t WideLowMask(int num){
+  return (num >= 64) ? ~0ULL : ((1ULL << num) - 1);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t WideMask64AVX2(const int64_t* keys, int num, int64_t key,
+                               int64_t bias, bool greater){
+  __m256i b = _mm256_set1_epi64x(bias);
+  __m256i k = _mm256_set1_epi64x(key ^ bias);
+  uint64_t mask = 0;
+  for (int i = 0; i < num; i += 4){
+    __m256i v = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+    __m256i cmp = greater ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+    mask |= static_cast<uint64_t>(
+      _mm256_movemask_pd(_mm256_castsi256_pd(cmp))) << i;
+  }
+  return mask & WideLowMask(num);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t WideMask32AVX2(const int32_t* keys, int num, int32_t key,
+                               int32_t bias, bool greater){
+  __m256i b = _mm256_set1_epi32(bias);
+  __m256i k = _mm256_set1_epi32(key ^ bias);
+  uint64_t mask = 0;
+  for (int i = 0; i < num; i += 8){
+    __m256i v = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+    __m256i cmp = greater ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+    mask |= static_cast<uint64_t>(
+      _mm256_movemask_ps(_mm256_castsi256_ps(cmp))) << i;
+  }
+  return mask & WideLowMask(num);
+}
+
+inline uint64_t WideMask32SSE2(const int32_t* keys, int num, int32_t key,
+                               int32_t bias, bool greater){
+  __m128i b = _mm_set1_epi32(bias);
+  __m128i k = _mm_set1_epi32(key ^ bias);
+  uint64_t mask = 0;
+  for (int i = 0; i < num; i += 4){
+    __m128i v = _mm_xor_si128(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), b);
+    __m128i cmp = greater ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v);
+    mask |= static_cast<uint64_t>(
+      _mm_movemask_ps(_mm_castsi128_ps(cmp))) << i;
+  }
+  return mask & WideLowMask(num);
+}
+
+#endif // LLRBPP_WIDE_X86
+
+/**
+ * In-node search of WideLLRBPP.
+ *   CountLess(keys, num, key)       : #{i < num : keys[i] < key}
+ *   CountNotGreater(keys, num, key) : #{i < num : !(key < keys[i])}
+ * keys[0, num) are sorted under Comp. 32- and 64-bit integer keys under
+ * std::less compare a whole node with SIMD (AVX2 if the CPU has it,
+ * else SSE2 for 32-bit keys), other arithmetic keys are counted by a
+ * branch-free linear scan, and the rest use binary search.
+ */
+template <class Key, class Comp>
+struct WideSearch{
+  static const int kKind =
+#ifdef LLRBPP_WIDE_X86
+    (std::is_integral<Key>::value &&
+     (sizeof(Key) == 4 || sizeof(Key) == 8) &&
+     (std::is_same<Comp, std::less<Key> >::value ||
+      std::is_same<Comp, std::less<> >::value)) ? 2 :
+#endif
+    std::is_arithmetic<Key>::value ? 1 : 0;
+
+  static int CountLess(const Key* keys, int num, const Key& key){
+    return Count(keys, num, key, false, std::integral_constant<int, kKind>());
+  }
+
+  static int CountNotGreater(const Key* keys, int num, const Key& key){
+    return num - Count(keys, num, key, true, std::integral_constant<int, kKind>());
+  }
+
+private:
+  // Count keys[i] < key, or keys[i] > key if greater.
+  static int Count(const Key* keys, int num, const Key& key, bool greater,
+                   std::integral_constant<int, 0>){
+    if (greater){
+      return static_cast<int>(keys + num - std::upper_bound(keys, keys + num, key, Comp()));
+    }
+    return static_cast<int>(std::lower_bound(keys, keys + num, key, Comp()) - keys);
+  }
+
+  static int Count(const Key* keys, int num, const Key& key, bool greater,
+                   std::integral_constant<int, 1>){
+    int count = 0;
+    if (greater){
+      for (int i = 0; i < num; ++i) count += Comp()(key, keys[i]);
+    } else {
+      for (int i = 0; i < num; ++i) count += Comp()(keys[i], key);
+    }
+    return count;
+  }
+
+#ifdef LLRBPP_WIDE_X86
+  static int Count(const Key* keys, int num, const Key& key, bool greater,
+                   std::integral_constant<int, 2>){
+    uint64_t mask;
+    if (sizeof(Key) == 8){
+      const int64_t bias = std::is_signed<Key>::value ? 0 : INT64_MIN;
+      if (!WideHasAVX2()){
+        return Count(keys, num, key, greater, std::integral_constant<int, 1>());
+      }
+      mask = WideMask64AVX2(reinterpret_cast<const int64_t*>(keys), num,
+                            static_cast<int64_t>(key), bias, greater);
+    } else {
+      const int32_t bias = std::is_signed<Key>::value ? 0 : INT32_MIN;
+      if (WideHasAVX2()){
+        mask = WideMask32AVX2(reinterpret_cast<const int32_t*>(keys), num,
+                              static_cast<int32_t>(key), bias, greater);
+      } else {
+        mask = WideMask32SSE2(reinterpret_cast<const int32_t*>(keys), num,
+                              static_cast<int32_t>(key), bias, greater);
+      }
+    }
+    return __builtin_popcountll(mask);
+  }
+#endif
+};
+
+/**
+ * B+ tree with the interface of LLRBPP.
+ * A left-leaning red-black tree encodes a 2-3 tree with one key per
+ * node, so a search takes one dependent cache miss per binary level.
+ * WideLLRBPP stores up to kKeys keys per node instead (about 256 bytes
+ * of keys, aligned to cache lines), so a search visits few nodes and
+ * compares each node's keys at once (see WideSearch). Keys and values
+ * are kept in separate arrays within a leaf, and the leaves are chained
+ * for ordered scans. Nodes are split and merged top-down, so Insert and
+ * Delete make a single pass from the root.
+ * Key and Val must be default constructible and movable.
+ */
+template <class Key, class Val, class Comp = std::less<Key> >
+class WideLLRBPP{
+  static constexpr int KeyNum(){
+    return (256 / sizeof(Key) < 8) ? 8 :
+      (256 / sizeof(Key) > 64) ? 64 : static_cast<int>(256 / sizeof(Key)) / 8 * 8;
+  }
+
+public:
+  // Max keys per node; a multiple of the SIMD width
+  static const int kKeys = KeyNum();
+
+  WideLLRBPP() : root_(NULL), height_(0), num_(0){
+  }
+
+  ~WideLLRBPP(){
+    Clear();
+  }
+
+  // Insert (key, val), or assign val if key exists.
+  template <class V>
+  void Insert(const Key& key, V&& val){
+    if (root_ == NULL){
+      root_ = new Leaf();
+      height_ = 0;
+    }
+    if (NodeNum(root_, height_) == kKeys){
+      Inner* root = new Inner();
+      root->children[0] = root_;
+      SplitChild(root, 0, height_);
+      root_ = root;
+      ++height_;
+    }
+    void* node = root_;
+    for (int level = height_; level > 0; --level){
+      Inner* inner = static_cast<Inner*>(node);
+      int i = Search::CountNotGreater(inner->keys, inner->num, key);
+      if (NodeNum(inner->children[i], level - 1) == kKeys){
+        SplitChild(inner, i, level - 1);
+        if (!Comp()(key, inner->keys[i])) ++i;
+      }
+      node = inner->children[i];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int pos = Search::CountLess(leaf->keys, leaf->num, key);
+    if (pos < leaf->num && !Comp()(key, leaf->keys[pos])){
+      leaf->vals[pos] = std::forward<V>(val);
+      return;
+    }
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->num, leaf->keys + leaf->num + 1);
+    std::move_backward(leaf->vals + pos, leaf->vals + leaf->num, leaf->vals + leaf->num + 1);
+    leaf->keys[pos] = key;
+    leaf->vals[pos] = std::forward<V>(val);
+    ++leaf->num;
+    ++num_;
+  }
+
+  void Delete(const Key& key){
+    if (root_ == NULL) return;
+    void* node = root_;
+    for (int level = height_; level > 0; --level){
+      Inner* inner = static_cast<Inner*>(node);
+      int i = Search::CountNotGreater(inner->keys, inner->num, key);
+      if (NodeNum(inner->children[i], level - 1) <= MinNum(level - 1)){
+        i = FixChild(inner, i, level - 1);
+      }
+      node = inner->children[i];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int pos = Search::CountLess(leaf->keys, leaf->num, key);
+    if (pos < leaf->num && !Comp()(key, leaf->keys[pos])){
+      std::move(leaf->keys + pos + 1, leaf->keys + leaf->num, leaf->keys + pos);
+      std::move(leaf->vals + pos + 1, leaf->vals + leaf->num, leaf->vals + pos);
+      --leaf->num;
+      --num_;
+    }
+    while (height_ > 0 && static_cast<Inner*>(root_)->num == 0){
+      Inner* root = static_cast<Inner*>(root_);
+      root_ = root->children[0];
+      delete root;
+      --height_;
+    }
+    if (height_ == 0 && static_cast<Leaf*>(root_)->num == 0){
+      delete static_cast<Leaf*>(root_);
+      root_ = NULL;
+    }
+  }
+
+  void Clear(){
+    if (root_ != NULL){
+      Destroy(root_, height_);
+    }
+    root_ = NULL;
+    height_ = 0;
+    num_ = 0;
+  }
+
+  // Return (true, value) if key exists and (false, Val()) otherwise.
+  std::pair<bool, Val> Find(const Key& key) const{
+    const Val* val = FindPtr(key);
+    if (val == NULL) return std::make_pair(false, Val());
+    return std::make_pair(true, *val);
+  }
+
+  // Return a pointer to the value of key, or NULL if key does not exist.
+  const Val* FindPtr(const Key& key) const{
+    if (root_ == NULL) return NULL;
+    const Leaf* leaf = FindLeaf(key);
+    int pos = Search::CountLess(leaf->keys, leaf->num, key);
+    if (pos == leaf->num || Comp()(key, leaf->keys[pos])) return NULL;
+    return &leaf->vals[pos];
+  }
+
+  bool Contains(const Key& key) const{
+    return FindPtr(key) != NULL;
+  }
+
+  // Call fn(key, val) for every key in [lo, hi) in ascending order.
+  template <class Fn>
+  void ForEachInRange(const Key& lo, const Key& hi, Fn fn) const{
+    if (root_ == NULL) return;
+    const Leaf* leaf = FindLeaf(lo);
+    int pos = Search::CountLess(leaf->keys, leaf->num, lo);
+    for (; leaf != NULL; leaf = leaf->next, pos = 0){
+      for (; pos < leaf->num; ++pos){
+        if (!Comp()(leaf->keys[pos], hi)) return;
+        fn(leaf->keys[pos], leaf->vals[pos]);
+      }
+    }
+  }
+
+  // The number of nodes on a path from the root to a leaf
+  int DepthMax() const{
+    return (root_ == NULL) ? 0 : height_ + 1;
+  }
+
+  uint64_t Num() const {
+    return num_;
+  }
+
+  // Return true iff the tree is a valid B+ tree holding Num() keys.
+  bool IsValid() const{
+    if (root_ == NULL) return num_ == 0;
+    uint64_t num = 0;
+    const Leaf* prev = NULL;
+    if (!IsValidInternal(root_, height_, true, NULL, NULL, num, prev)) return false;
+    return prev->next == NULL && num == num_;
+  }
+
+private:
+  typedef WideSearch<Key, Comp> Search;
+
+  // keys come first so that they start at a cache line
+  struct alignas(64) Leaf{
+    Leaf() : keys(), num(0), next(NULL), vals(){
+    }
+    Key keys[kKeys];
+    int num;
+    Leaf* next;
+    Val vals[kKeys];
+  };
+
+  // children[i] holds the keys in [keys[i-1], keys[i]) and is an Inner
+  // one level up from the leaves or higher, and a Leaf otherwise.
+  struct alignas(64) Inner{
+    Inner() : keys(), num(0), children(){
+    }
+    Key keys[kKeys];
+    int num;
+    void* children[kKeys + 1];
+  };
+
+  const Leaf* FindLeaf(const Key& key) const{
+    const void* node = root_;
+    for (int level = height_; level > 0; --level){
+      const Inner* inner = static_cast<const Inner*>(node);
+      node = inner->children[Search::CountNotGreater(inner->keys, inner->num, key)];
+    }
+    return static_cast<const Leaf*>(node);
+  }
+
+  static int NodeNum(const void* node, int level){
+    if (level == 0) return static_cast<const Leaf*>(node)->num;
+    return static_cast<const Inner*>(node)->num;
+  }
+
+  // A non-root node keeps at least MinNum keys, so that two siblings at
+  // the minimum fit in one node when merged.
+  static int MinNum(int level){
+    return (level == 0) ? kKeys / 2 : (kKeys - 1) / 2;
+  }
+
+  // Split the full child parent->children[i] into two halves.
+  void SplitChild(Inner* parent, int i, int level){
+    void* right;
+    Key separator;
+    if (level == 0){
+      Leaf* left = static_cast<Leaf*>(parent->children[i]);
+      Leaf* leaf = new Leaf();
+      int mid = left->num / 2;
+      std::move(left->keys + mid, left->keys + left->num, leaf->keys);
+      std::move(left->vals + mid, left->vals + left->num, leaf->vals);
+      leaf->num = left->num - mid;
+      left->num = mid;
+      leaf->next = left->next;
+      left->next = leaf;
+      separator = leaf->keys[0];
+      right = leaf;
+    } else {
+      Inner* left = static_cast<Inner*>(parent->children[i]);
+      Inner* inner = new Inner();
+      int mid = left->num / 2;
+      separator = std::move(left->keys[mid]);
+      std::move(left->keys + mid + 1, left->keys + left->num, inner->keys);
+      std::copy(left->children + mid + 1, left->children + left->num + 1, inner->children);
+      inner->num = left->num - mid - 1;
+      left->num = mid;
+      right = inner;
+    }
+    std::move_backward(parent->keys + i, parent->keys + parent->num,
+                       parent->keys + parent->num + 1);
+    std::copy_backward(parent->children + i + 1, parent->children + parent->num + 1,
+                       parent->children + parent->num + 2);
+    parent->keys[i] = std::move(separator);
+    parent->children[i + 1] = right;
+    ++parent->num;
+  }
+
+  // Give parent->children[i] more than MinNum keys by borrowing from a
+  // sibling or merging with one. Return the new index of the child.
+  int FixChild(Inner* parent, int i, int level){
+    if (i > 0 && NodeNum(parent->children[i - 1], level) > MinNum(level)){
+      BorrowFromLeft(parent, i, level);
+      return i;
+    }
+    if (i < parent->num && NodeNum(parent->children[i + 1], level) > MinNum(level)){
+      BorrowFromRight(parent, i, level);
+      return i;
+    }
+    if (i > 0){
+      Merge(parent, i - 1, level);
+      return i - 1;
+    }
+    Merge(parent, i, level);
+    return i;
+  }
+
+  void BorrowFromLeft(Inner* parent, int i, int level){
+    if (level == 0){
+      Leaf* left = static_cast<Leaf*>(parent->children[i - 1]);
+      Leaf* child = static_cast<Leaf*>(parent->children[i]);
+      std::move_backward(child->keys, child->keys + child->num, child->keys + child->num + 1);
+      std::move_backward(child->vals, child->vals + child->num, child->vals + child->num + 1);
+      --left->num;
+      child->keys[0] = std::move(left->keys[left->num]);
+      child->vals[0] = std::move(left->vals[left->num]);
+      ++child->num;
+      parent->keys[i - 1] = child->keys[0];
+    } else {
+      Inner* left = static_cast<Inner*>(parent->children[i - 1]);
+      Inner* child = static_cast<Inner*>(parent->children[i]);
+      std::move_backward(child->keys, child->keys + child->num, child->keys + child->num + 1);
+      std::copy_backward(child->children, child->children + child->num + 1,
+                         child->children + child->num + 2);
+      child->keys[0] = std::move(parent->keys[i - 1]);
+      child->children[0] = left->children[left->num];
+      ++child->num;
+      --left->num;
+      parent->keys[i - 1] = std::move(left->keys[left->num]);
+    }
+  }
+
+  void BorrowFromRight(Inner* parent, int i, int level){
+    if (level == 0){
+      Leaf* child = static_cast<Leaf*>(parent->children[i]);
+      Leaf* right = static_cast<Leaf*>(parent->children[i + 1]);
+      child->keys[child->num] = std::move(right->keys[0]);
+      child->vals[child->num] = std::move(right->vals[0]);
+      ++child->num;
+      std::move(right->keys + 1, right->keys + right->num, right->keys);
+      std::move(right->vals + 1, right->vals + right->num, right->vals);
+      --right->num;
+      parent->keys[i] = right->keys[0];
+    } else {
+      Inner* child = static_cast<Inner*>(parent->children[i]);
+      Inner* right = static_cast<Inner*>(parent->children[i + 1]);
+      child->keys[child->num] = std::move(parent->keys[i]);
+      child->children[child->num + 1] = right->children[0];
+      ++child->num;
+      parent->keys[i] = std::move(right->keys[0]);
+      std::move(right->keys + 1, right->keys + right->num, right->keys);
+      std::copy(right->children + 1, right->children + right->num + 1, right->children);
+      --right->num;
+    }
+  }
+
+  // Merge parent->children[j + 1] into parent->children[j].
+  void Merge(Inner* parent, int j, int level){
+    if (level == 0){
+      Leaf* left = static_cast<Leaf*>(parent->children[j]);
+      Leaf* right = static_cast<Leaf*>(parent->children[j + 1]);
+      std::move(right->keys, right->keys + right->num, left->keys + left->num);
+      std::move(right->vals, right->vals + right->num, left->vals + left->num);
+      left->num += right->num;
+      left->next = right->next;
+      delete right;
+    } else {
+      Inner* left = static_cast<Inner*>(parent->children[j]);
+      Inner* right = static_cast<Inner*>(parent->children[j + 1]);
+      left->keys[left->num] = std::move(parent->keys[j]);
+      std::move(right->keys, right->keys + right->num, left->keys + left->num + 1);
+      std::copy(right->children, right->children + right->num + 1,
+                left->children + left->num + 1);
+      left->num += right->num + 1;
+      delete right;
+    }
+    std::move(parent->keys + j + 1, parent->keys + parent->num, parent->keys + j);
+    std::copy(parent->children + j + 2, parent->children + parent->num + 1,
+              parent->children + j + 1);
+    --parent->num;
+  }
+
+  void Destroy(void* node, int level){
+    if (level == 0){
+      delete static_cast<Leaf*>(node);
+      return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (int i = 0; i <= inner->num; ++i){
+      Destroy(inner->children[i], level - 1);
+    }
+    delete inner;
+  }
+
+  // Check order, occupancy and the leaf chain; leaves are visited in
+  // order and prev is the last one visited.
+  bool IsValidInternal(const void* node, int level, bool is_root,
+                       const Key* lo, const Key* hi, uint64_t& num,
+                       const Leaf*& prev) const{
+    int node_num = NodeNum(node, level);
+    if (node_num > kKeys) return false;
+    if (!is_root && node_num < MinNum(level)) return false;
+    if (level == 0){
+      const Leaf* leaf = static_cast<const Leaf*>(node);
+      if (prev != NULL && prev->next != leaf) return false;
+      prev = leaf;
+      for (int i = 0; i < leaf->num; ++i){
+        if (i > 0 && !Comp()(leaf->keys[i - 1], leaf->keys[i])) return false;
+        if (lo != NULL && Comp()(leaf->keys[i], *lo)) return false;
+        if (hi != NULL && !Comp()(leaf->keys[i], *hi)) return false;
+      }
+      num += leaf->num;
+      return leaf->num > 0;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    if (inner->num == 0) return false;
+    for (int i = 0; i <= inner->num; ++i){
+      if (i > 0 && i < inner->num && !Comp()(inner->keys[i - 1], inner->keys[i])) return false;
+      const Key* child_lo = (i == 0) ? lo : &inner->keys[i - 1];
+      const Key* child_hi = (i == inner->num) ? hi : &inner->keys[i];
+      if (!IsValidInternal(inner->children[i], level - 1, false,
+                           child_lo, child_hi, num, prev)){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  WideLLRBPP(const WideLLRBPP&);
+  WideLLRBPP& operator=(const WideLLRBPP&);
+
+  void* root_;
+  int height_; // the number of Inner levels
+  uint64_t num_;
+};
+
+} // namespace llrbpp
+
+#endif // LLRBPP_WIDE_HPP_
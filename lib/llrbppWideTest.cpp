@@ -0,0 +1,137 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <map>
+#include <vector>
+#include "llrbppWide.hpp"
+
+using namespace std;
+
+template <class Tree, class Key>
+void RandomWide(Tree& fid, int n, const vector<Key>& key_set){
+  map<Key, int> m;
+  for (int i = 0; i < n; ++i){
+    const Key& key = key_set[rand() % key_set.size()];
+    if (rand() % 3 == 0){
+      fid.Delete(key);
+      m.erase(key);
+    } else {
+      fid.Insert(key, i);
+      m[key] = i;
+    }
+    if (i % 1000 == 0){
+      ASSERT_TRUE(fid.IsValid()) << " i=" << i;
+    }
+  }
+  ASSERT_TRUE(fid.IsValid());
+  ASSERT_EQ(m.size(), fid.Num());
+  for (size_t i = 0; i < key_set.size(); ++i){
+    typename map<Key, int>::const_iterator it = m.find(key_set[i]);
+    if (it == m.end()){
+      EXPECT_EQ(make_pair(false, int()), fid.Find(key_set[i]));
+    } else {
+      EXPECT_EQ(make_pair(true, it->second), fid.Find(key_set[i]));
+    }
+  }
+  for (typename map<Key, int>::const_iterator it = m.begin(); it != m.end(); ++it){
+    fid.Delete(it->first);
+  }
+  EXPECT_EQ(0, fid.Num());
+  EXPECT_TRUE(fid.IsValid());
+}
+
+TEST(WideLLRBPP, trivial){
+  llrbpp::WideLLRBPP<string, int> fid;
+  EXPECT_EQ(0, fid.Num());
+  fid.Insert("eee", 5);
+  fid.Insert("aaa", 3);
+  fid.Insert("bbb", 4);
+  EXPECT_EQ(3, fid.Num());
+  EXPECT_EQ(make_pair(true, 5), fid.Find("eee"));
+  EXPECT_EQ(make_pair(false, int()), fid.Find("ddd"));
+  fid.Delete("eee");
+  EXPECT_FALSE(fid.Contains("eee"));
+  fid.Clear();
+  EXPECT_EQ(0, fid.Num());
+  EXPECT_TRUE(fid.IsValid());
+}
+
+TEST(WideLLRBPP, uint64){
+  vector<uint64_t> keys;
+  for (int i = 0; i < 20000; ++i){
+    // the top bit exercises the unsigned comparison
+    keys.push_back((static_cast<uint64_t>(rand()) << 33) ^ rand());
+  }
+  llrbpp::WideLLRBPP<uint64_t, int> fid;
+  RandomWide(fid, 100000, keys);
+}
+
+TEST(WideLLRBPP, int64){
+  vector<int64_t> keys;
+  for (int i = 0; i < 20000; ++i){
+    keys.push_back(static_cast<int64_t>(rand()) - RAND_MAX / 2);
+  }
+  llrbpp::WideLLRBPP<int64_t, int> fid;
+  RandomWide(fid, 100000, keys);
+}
+
+TEST(WideLLRBPP, uint32){
+  vector<uint32_t> keys;
+  for (int i = 0; i < 20000; ++i){
+    keys.push_back(static_cast<uint32_t>(rand()) * 2);
+  }
+  llrbpp::WideLLRBPP<uint32_t, int> fid;
+  RandomWide(fid, 100000, keys);
+}
+
+TEST(WideLLRBPP, double){
+  vector<double> keys;
+  for (int i = 0; i < 5000; ++i){
+    keys.push_back(rand() / 7.0 - 1000.0);
+  }
+  llrbpp::WideLLRBPP<double, int> fid;
+  RandomWide(fid, 30000, keys);
+}
+
+TEST(WideLLRBPP, string){
+  vector<string> keys;
+  for (int i = 0; i < 5000; ++i){
+    keys.push_back(to_string(rand()));
+  }
+  llrbpp::WideLLRBPP<string, int> fid;
+  RandomWide(fid, 30000, keys);
+}
+
+TEST(WideLLRBPP, range){
+  llrbpp::WideLLRBPP<int, int> fid;
+  for (int i = 0; i < 10000; ++i){
+    fid.Insert(i * 2, i);
+  }
+  vector<int> got;
+  fid.ForEachInRange(101, 2001, [&](int key, int val){
+      EXPECT_EQ(key, val * 2);
+      got.push_back(key);
+    });
+  ASSERT_EQ(950, got.size());
+  EXPECT_EQ(102, got.front());
+  EXPECT_EQ(2000, got.back());
+  EXPECT_GE(4, fid.DepthMax());
+}
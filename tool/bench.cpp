@@ -0,0 +1,521 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "../lib/llrbpp.hpp"
+#include "../lib/llrbppConcurrent.hpp"
+#include "../lib/llrbppFile.hpp"
+#include "../lib/llrbppFrozen.hpp"
+#include "../lib/llrbppPersistent.hpp"
+#include "../lib/llrbppSharded.hpp"
+#include "../lib/llrbppWide.hpp"
+
+#include <sys/time.h>
+double gettimeofday_sec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + (double)tv.tv_usec*1e-6;
+}
+
+using namespace std;
+
+uint64_t RandKey(){
+  return (static_cast<uint64_t>(rand()) << 31) ^ rand();
+}
+
+string ToStringKey(uint64_t key){
+  char buf[64];
+  snprintf(buf, sizeof(buf), "key-%020llu", static_cast<unsigned long long>(key));
+  return buf;
+}
+
+template <class Tree>
+void BenchClear(const char* name, const vector<uint64_t>& keys){
+  Tree tree;
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], keys[i]);
+  }
+  double begin_time = gettimeofday_sec();
+  tree.Clear();
+  cout << "clear\t" << name << "\t" << keys.size() << "\t" 
+       << gettimeofday_sec() - begin_time << endl;
+}
+
+template <class Tree>
+void BenchClearString(const char* name, const vector<uint64_t>& keys){
+  Tree tree;
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(ToStringKey(keys[i]), keys[i]);
+  }
+  double begin_time = gettimeofday_sec();
+  tree.Clear();
+  cout << "clear\t" << name << "\t" << keys.size() << "\t" 
+       << gettimeofday_sec() - begin_time << endl;
+}
+
+template <class Tree>
+void BenchUpdate(const char* name, const vector<uint64_t>& keys){
+  Tree tree;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], keys[i]);
+  }
+  double insert_time = gettimeofday_sec() - begin_time;
+
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  double overwrite_time = gettimeofday_sec() - begin_time;
+
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Delete(keys[i]);
+  }
+  double delete_time = gettimeofday_sec() - begin_time;
+  cout << "insert\t" << name << "\t" << keys.size() << "\t" << insert_time << endl
+       << "overwrite\t" << name << "\t" << keys.size() << "\t" << overwrite_time << endl
+       << "delete\t" << name << "\t" << keys.size() << "\t" << delete_time << endl;
+}
+
+void BenchBuild(const vector<uint64_t>& keys){
+  vector<pair<uint64_t, uint64_t> > kvs(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i){
+    kvs[i] = make_pair(keys[i], i);
+  }
+  sort(kvs.begin(), kvs.end());
+  kvs.erase(unique(kvs.begin(), kvs.end()), kvs.end());
+
+  llrbpp::LLRBPP<uint64_t, uint64_t> tree;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < kvs.size(); ++i){
+    tree.Insert(kvs[i].first, kvs[i].second);
+  }
+  cout << "build\tinsert\t" << kvs.size() << "\t" 
+       << gettimeofday_sec() - begin_time << endl;
+  tree.Clear();
+
+  begin_time = gettimeofday_sec();
+  tree.BuildFromSorted(kvs.begin(), kvs.end());
+  cout << "build\tsorted\t" << kvs.size() << "\t" 
+       << gettimeofday_sec() - begin_time << endl;
+}
+
+void BenchBatch(const vector<uint64_t>& keys, size_t half, size_t batch_num,
+                bool batched){
+  llrbpp::LLRBPP<uint64_t, uint64_t> tree;
+  for (size_t i = 0; i < half; ++i){
+    tree.Insert(keys[i], i);
+  }
+  double begin_time = gettimeofday_sec();
+  vector<pair<uint64_t, uint64_t> > batch;
+  for (size_t i = half; i < keys.size(); i += batch_num){
+    batch.clear();
+    for (size_t j = i; j < i + batch_num && j < keys.size(); ++j){
+      batch.push_back(make_pair(keys[j], j));
+    }
+    sort(batch.begin(), batch.end());
+    if (batched){
+      tree.InsertBatch(batch.begin(), batch.end());
+    } else {
+      for (size_t j = 0; j < batch.size(); ++j){
+        tree.Insert(batch[j].first, batch[j].second);
+      }
+    }
+  }
+  cout << "batch\t" << (batched ? "InsertBatch" : "Insert") << "\t" 
+       << half << "\t" << batch_num << "\t" << keys.size() - half << "\t" 
+       << gettimeofday_sec() - begin_time << endl;
+}
+
+template <class Tree>
+void BenchLookup(const char* name, const vector<uint64_t>& keys){
+  Tree tree;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  double insert_time = gettimeofday_sec() - begin_time;
+
+  vector<uint64_t> probes(keys);
+  random_shuffle(probes.begin(), probes.end());
+  uint64_t hit = 0;
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    hit += tree.Contains(probes[i]);
+  }
+  double find_time = gettimeofday_sec() - begin_time;
+
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    tree.Delete(probes[i]);
+  }
+  double delete_time = gettimeofday_sec() - begin_time;
+  if (hit != probes.size()) cerr << "lookup: lost keys" << endl;
+  cout << "insert\t" << name << "\t" << keys.size() << "\t" << insert_time << endl
+       << "find\t" << name << "\t" << keys.size() << "\t" << find_time << endl
+       << "delete\t" << name << "\t" << keys.size() << "\t" << delete_time << endl;
+}
+
+void BenchFreeze(const vector<uint64_t>& keys){
+  llrbpp::LLRBPP<uint64_t, uint64_t> tree;
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  double begin_time = gettimeofday_sec();
+  llrbpp::FrozenLLRBPP<uint64_t, uint64_t> frozen = llrbpp::Freeze(tree);
+  double freeze_time = gettimeofday_sec() - begin_time;
+
+  vector<uint64_t> probes(keys);
+  random_shuffle(probes.begin(), probes.end());
+  uint64_t hit = 0;
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    hit += tree.Contains(probes[i]);
+  }
+  double tree_time = gettimeofday_sec() - begin_time;
+
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    hit += frozen.Contains(probes[i]);
+  }
+  double frozen_time = gettimeofday_sec() - begin_time;
+  if (hit != 2 * probes.size()) cerr << "freeze: lost keys" << endl;
+  cout << "freeze\t" << keys.size() << "\t" << freeze_time << endl
+       << "find\tllrbpp\t" << keys.size() << "\t" << tree_time << endl
+       << "find\tfrozen\t" << keys.size() << "\t" << frozen_time << endl;
+}
+
+void BenchFindBatch(const vector<uint64_t>& keys, size_t batch_num){
+  llrbpp::LLRBPP<uint64_t, uint64_t> tree;
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  vector<uint64_t> probes(keys);
+  random_shuffle(probes.begin(), probes.end());
+  uint64_t hit = 0;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    hit += (tree.FindPtr(probes[i]) != NULL);
+  }
+  double scalar_time = gettimeofday_sec() - begin_time;
+
+  vector<const uint64_t*> out(batch_num);
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); i += batch_num){
+    size_t num = min(batch_num, probes.size() - i);
+    tree.FindBatch(&probes[i], num, &out[0]);
+    for (size_t j = 0; j < num; ++j){
+      hit += (out[j] != NULL);
+    }
+  }
+  double batch_time = gettimeofday_sec() - begin_time;
+  if (hit != 2 * probes.size()) cerr << "findbatch: lost keys" << endl;
+  cout << "find\tFindPtr\t" << keys.size() << "\t" << scalar_time << endl
+       << "find\tFindBatch\t" << keys.size() << "\t" << batch_num << "\t"
+       << batch_time << endl;
+}
+
+// LLRBPP behind one mutex, the baseline of ConcurrentLLRBPP.
+class LockedLLRBPP{
+public:
+  void Insert(uint64_t key, uint64_t val){
+    lock_guard<mutex> lock(mutex_);
+    tree_.Insert(key, val);
+  }
+  void Delete(uint64_t key){
+    lock_guard<mutex> lock(mutex_);
+    tree_.Delete(key);
+  }
+  bool Contains(uint64_t key) const{
+    lock_guard<mutex> lock(mutex_);
+    return tree_.Contains(key);
+  }
+private:
+  llrbpp::LLRBPP<uint64_t, uint64_t> tree_;
+  mutable mutex mutex_;
+};
+
+// reader_num threads look up every key while one thread rewrites a
+// tenth of them.
+template <class Tree>
+void BenchConcurrent(const char* name, const vector<uint64_t>& keys,
+                     int reader_num){
+  Tree tree;
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  atomic<uint64_t> hit(0);
+  double begin_time = gettimeofday_sec();
+  vector<thread> threads;
+  for (int r = 0; r < reader_num; ++r){
+    threads.push_back(thread([&tree, &keys, &hit, r](){
+          uint64_t local_hit = 0;
+          for (size_t i = 0; i < keys.size(); ++i){
+            local_hit += tree.Contains(keys[(i * 7 + r) % keys.size()]);
+          }
+          hit += local_hit;
+        }));
+  }
+  threads.push_back(thread([&tree, &keys](){
+        for (size_t i = 0; i < keys.size(); i += 10){
+          tree.Delete(keys[i]);
+          tree.Insert(keys[i], i);
+        }
+      }));
+  for (size_t i = 0; i < threads.size(); ++i){
+    threads[i].join();
+  }
+  double elapsed = gettimeofday_sec() - begin_time;
+  cout << "concurrent\t" << name << "\t" << keys.size() << "\t"
+       << reader_num << "\t" << elapsed << "\t"
+       << reader_num * keys.size() / elapsed << " reads/s" << endl;
+  if (hit.load() == 0) cerr << "concurrent: lost keys" << endl;
+}
+
+// Insert every key, then replace each with a new key, taking a snapshot
+// every snapshot_interval replacements (0: none) and keeping the last.
+template <class Tree>
+void BenchPersistent(const char* name, const vector<uint64_t>& keys,
+                     size_t snapshot_interval){
+  Tree tree;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  double insert_time = gettimeofday_sec() - begin_time;
+  Tree snapshot;
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    if (snapshot_interval > 0 && i % snapshot_interval == 0){
+      snapshot = tree;
+    }
+    tree.Delete(keys[i]);
+    tree.Insert(~keys[i], i);
+  }
+  double update_time = gettimeofday_sec() - begin_time;
+  cout << "persistent\t" << name << "\t" << keys.size() << "\t"
+       << snapshot_interval << "\t" << insert_time << "\t" << update_time
+       << endl;
+}
+
+// thread_num threads split keys.size() operations, half inserts and
+// half lookups, over a map preloaded with half of the keys.
+template <class Tree>
+void BenchSharded(const char* name, Tree& tree, const vector<uint64_t>& keys,
+                  size_t thread_num){
+  for (size_t i = 0; i < keys.size(); i += 2){
+    tree.Insert(keys[i], i);
+  }
+  atomic<uint64_t> hit(0);
+  double begin_time = gettimeofday_sec();
+  vector<thread> threads;
+  for (size_t t = 0; t < thread_num; ++t){
+    threads.push_back(thread([&tree, &keys, &hit, t, thread_num](){
+          uint64_t local_hit = 0;
+          for (size_t i = t; i < keys.size(); i += thread_num){
+            if (i % 2 == 1){
+              tree.Insert(keys[i], i);
+            } else {
+              local_hit += tree.Contains(keys[i]);
+            }
+          }
+          hit += local_hit;
+        }));
+  }
+  for (size_t t = 0; t < threads.size(); ++t){
+    threads[t].join();
+  }
+  double elapsed = gettimeofday_sec() - begin_time;
+  cout << "sharded\t" << name << "\t" << keys.size() << "\t" << thread_num
+       << "\t" << elapsed << "\t" << keys.size() / elapsed << " ops/s" << endl;
+  if (hit.load() != (keys.size() + 1) / 2) cerr << "sharded: lost keys" << endl;
+}
+
+// Restart costs: inserting every key, LoadImage of a saved image, and
+// opening the image mapped, then looking up every key in each.
+void BenchFile(const vector<uint64_t>& keys){
+  const char* path = "/tmp/llrbppbench.img";
+  llrbpp::LLRBPP<uint64_t, uint64_t> tree;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < keys.size(); ++i){
+    tree.Insert(keys[i], i);
+  }
+  double insert_time = gettimeofday_sec() - begin_time;
+  begin_time = gettimeofday_sec();
+  llrbpp::SaveImage(tree, path);
+  double save_time = gettimeofday_sec() - begin_time;
+
+  llrbpp::LLRBPP<uint64_t, uint64_t> loaded;
+  begin_time = gettimeofday_sec();
+  llrbpp::LoadImage(loaded, path);
+  double load_time = gettimeofday_sec() - begin_time;
+  begin_time = gettimeofday_sec();
+  llrbpp::MappedLLRBPP<uint64_t, uint64_t> mapped(path, false);
+  double map_time = gettimeofday_sec() - begin_time;
+
+  vector<uint64_t> probes(keys);
+  random_shuffle(probes.begin(), probes.end());
+  uint64_t hit = 0;
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    hit += loaded.Contains(probes[i]);
+  }
+  double loaded_find_time = gettimeofday_sec() - begin_time;
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < probes.size(); ++i){
+    hit += mapped.Contains(probes[i]);
+  }
+  double mapped_find_time = gettimeofday_sec() - begin_time;
+  if (hit != 2 * probes.size()) cerr << "file: lost keys" << endl;
+  remove(path);
+  cout << "file\tinsert\t" << keys.size() << "\t" << insert_time << endl
+       << "file\tsave\t" << keys.size() << "\t" << save_time << endl
+       << "file\tload\t" << keys.size() << "\t" << load_time << endl
+       << "file\tmap\t" << keys.size() << "\t" << map_time << endl
+       << "find\tloaded\t" << keys.size() << "\t" << loaded_find_time << endl
+       << "find\tmapped\t" << keys.size() << "\t" << mapped_find_time << endl;
+}
+
+// Comparators counting key comparisons: one per Comp or Compare call.
+struct CountingLess{
+  static uint64_t count;
+  bool operator()(const string& a, const string& b) const{
+    ++count;
+    return a < b;
+  }
+};
+
+uint64_t CountingLess::count = 0;
+
+struct CountingCompare{
+  static uint64_t count;
+  bool operator()(const string& a, const string& b) const{
+    ++count;
+    return a < b;
+  }
+  int Compare(const string& a, const string& b) const{
+    ++count;
+    return a.compare(b);
+  }
+};
+
+uint64_t CountingCompare::count = 0;
+
+template <class Comp>
+void ReportCompare(const char* name, const char* op, size_t num,
+                   double begin_time){
+  cout << "compare\t" << name << "\t" << op << "\t" << num << "\t"
+       << static_cast<double>(Comp::count) / num << "\t"
+       << gettimeofday_sec() - begin_time << endl;
+  Comp::count = 0;
+}
+
+template <class Comp>
+void BenchCompare(const char* name, const vector<uint64_t>& keys){
+  vector<string> skeys(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i){
+    skeys[i] = ToStringKey(keys[i]);
+  }
+  llrbpp::LLRBPP<string, uint64_t, Comp> tree;
+  Comp::count = 0;
+  double begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < skeys.size(); ++i){
+    tree.Insert(skeys[i], i);
+  }
+  ReportCompare<Comp>(name, "insert", skeys.size(), begin_time);
+
+  begin_time = gettimeofday_sec();
+  uint64_t hit = 0;
+  for (size_t i = 0; i < skeys.size(); ++i){
+    hit += tree.Contains(skeys[i]);
+  }
+  ReportCompare<Comp>(name, "find", skeys.size(), begin_time);
+
+  begin_time = gettimeofday_sec();
+  for (size_t i = 0; i < skeys.size(); ++i){
+    tree.Delete(skeys[i]);
+  }
+  ReportCompare<Comp>(name, "delete", skeys.size(), begin_time);
+  if (hit != skeys.size()) cerr << "compare: lost keys" << endl;
+}
+
+int main(int argc, char* argv[]){
+  string mode = (argc > 1) ? argv[1] : "all";
+  uint64_t N = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1000000;
+
+  vector<uint64_t> keys(N);
+  for (uint64_t i = 0; i < N; ++i){
+    keys[i] = RandKey();
+  }
+
+  if (mode == "all" || mode == "clear"){
+    BenchClear<llrbpp::LLRBPP<uint64_t, uint64_t> >("pool", keys);
+    BenchClear<llrbpp::LLRBPP<uint64_t, uint64_t, less<uint64_t>, 
+      llrbpp::NewDeleteAllocator> >("newdelete", keys);
+    BenchClearString<llrbpp::LLRBPP<string, uint64_t> >("pool-string", keys);
+    BenchClearString<llrbpp::LLRBPP<string, uint64_t, less<string>, 
+      llrbpp::NewDeleteAllocator> >("newdelete-string", keys);
+  }
+  if (mode == "all" || mode == "update"){
+    BenchUpdate<llrbpp::LLRBPP<uint64_t, uint64_t> >("pool", keys);
+  }
+  if (mode == "all" || mode == "build"){
+    BenchBuild(keys);
+  }
+  if (mode == "all" || mode == "batch"){
+    for (size_t batch_num = 1000; batch_num <= keys.size(); batch_num *= 10){
+      BenchBatch(keys, keys.size() / 2, batch_num, false);
+      BenchBatch(keys, keys.size() / 2, batch_num, true);
+    }
+    BenchBatch(keys, keys.size() / 10, keys.size(), false);
+    BenchBatch(keys, keys.size() / 10, keys.size(), true);
+  }
+  if (mode == "all" || mode == "wide"){
+    BenchLookup<llrbpp::LLRBPP<uint64_t, uint64_t> >("llrbpp", keys);
+    BenchLookup<llrbpp::WideLLRBPP<uint64_t, uint64_t> >("wide", keys);
+  }
+  if (mode == "all" || mode == "freeze"){
+    BenchFreeze(keys);
+  }
+  if (mode == "all" || mode == "findbatch"){
+    BenchFindBatch(keys, 64);
+    BenchFindBatch(keys, 1024);
+  }
+  if (mode == "all" || mode == "concurrent"){
+    for (int reader_num = 1; reader_num <= 8; reader_num *= 2){
+      BenchConcurrent<LockedLLRBPP>("mutex", keys, reader_num);
+      BenchConcurrent<llrbpp::ConcurrentLLRBPP<uint64_t, uint64_t> >(
+        "concurrent", keys, reader_num);
+    }
+  }
+  if (mode == "all" || mode == "persistent"){
+    typedef llrbpp::PersistentLLRBPP<uint64_t, uint64_t> Persistent;
+    BenchPersistent<Persistent>("persistent", keys, 0);
+    BenchPersistent<Persistent>("persistent", keys, 1000);
+    BenchPersistent<Persistent>("persistent", keys, 10);
+    BenchPersistent<Persistent>("persistent", keys, 1);
+  }
+  if (mode == "all" || mode == "sharded"){
+    for (size_t thread_num = 1; thread_num <= 64; thread_num *= 2){
+      LockedLLRBPP locked;
+      BenchSharded("mutex", locked, keys, thread_num);
+      llrbpp::ShardedLLRBPP<uint64_t, uint64_t> sharded(64);
+      BenchSharded("sharded64", sharded, keys, thread_num);
+    }
+  }
+  if (mode == "all" || mode == "file"){
+    BenchFile(keys);
+  }
+  if (mode == "all" || mode == "compare"){
+    BenchCompare<CountingLess>("less", keys);
+    BenchCompare<CountingCompare>("compare3", keys);
+  }
+  return 0;
+}
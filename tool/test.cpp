@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cmath>
 #include <queue>
+#include <vector>
 #include <stdlib.h>
 #include "../lib/llrbpp.hpp"
 #include "../lib/PrefixSum.hpp"
@@ -55,6 +56,15 @@ int main(int argc, char* argv[]){
     sum += ps.GetPrefixSum(ind);
   }
   cout << gettimeofday_sec() - begin_time << endl;
+
+  vector<uint64_t> inds(query_num);
+  for (int i = 0; i < query_num; ++i){
+    inds[i] = rand() % N;
+  }
+  vector<int64_t> sums(query_num);
+  begin_time = gettimeofday_sec();
+  ps.GetPrefixSumBatch(&inds[0], query_num, &sums[0]);
+  cout << gettimeofday_sec() - begin_time << endl;
   
   return 0;
 }